@@ -1,7 +1,14 @@
 #include "test_runner.h"
+#include "profile.h"
 
+#include <cstdint>
 #include <forward_list>
 #include <iterator>
+#include <random>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
@@ -51,6 +58,137 @@ private:
   Hasher hasher;
 };
 
+// Same interface on open addressing: values lie right in one array, probed linearly
+// with Robin Hood placement. A value displaces any value that sits closer to its own
+// home slot, so a lookup stops as soon as it meets such a value, and Erase shifts
+// the following values back instead of leaving tombstones.
+// The table doubles when it gets 7/8 full, so probes stay short whatever the size.
+template <typename Type, typename Hasher>
+class FlatHashSet {
+public:
+  explicit FlatHashSet(
+      size_t expected_size = 0,
+      const Hasher& hasher_ = {}
+  ) : hasher(hasher_) {
+    size_t capacity = MIN_CAPACITY;
+    while (capacity * MAX_LOAD_NUM < expected_size * MAX_LOAD_DEN) {
+      capacity *= 2;
+    }
+    Reset(capacity);
+  }
+
+  void Add(const Type& value) {
+    if (Has(value)) {
+      return;
+    }
+    if ((size + 1) * MAX_LOAD_DEN > values.size() * MAX_LOAD_NUM) {
+      Grow();
+    }
+    Insert(value);
+  }
+
+  bool Has(const Type& value) const {
+    return Find(value) != NOT_FOUND;
+  }
+
+  void Erase(const Type& value) {
+    size_t pos = Find(value);
+    if (pos == NOT_FOUND) {
+      return;
+    }
+    // Backward shift: pull up the values that were pushed past this slot
+    for (size_t next = (pos + 1) & mask; distances[next] > 1; next = (next + 1) & mask) {
+      distances[pos] = distances[next] - 1;
+      values[pos] = move(values[next]);
+      pos = next;
+    }
+    distances[pos] = 0;
+    --size;
+  }
+
+  size_t Size() const {
+    return size;
+  }
+
+private:
+  static const size_t MIN_CAPACITY = 8;
+  static const size_t MAX_LOAD_NUM = 7;
+  static const size_t MAX_LOAD_DEN = 8;
+  // Distances are kept in a byte, a longer probe makes the table grow
+  static const uint8_t MAX_DISTANCE = 255;
+  static const size_t NOT_FOUND = static_cast<size_t>(-1);
+
+  // Probe distance + 1 for every slot, 0 for empty ones.
+  // Kept apart from the values so that probing scans a dense byte array.
+  vector<uint8_t> distances;
+  vector<Type> values;
+  size_t mask = 0;
+  int shift = 0;
+  size_t size = 0;
+  Hasher hasher;
+
+  void Reset(size_t capacity) {
+    distances.assign(capacity, 0);
+    values.assign(capacity, Type{});
+    mask = capacity - 1;
+    shift = 64;
+    for (size_t i = capacity; i > 1; i /= 2) {
+      --shift;
+    }
+    size = 0;
+  }
+
+  size_t GetHome(const Type& value) const {
+    // Fibonacci hashing: the top bits of the product depend on all bits of the hash,
+    // hashers like IntHasher return the value itself
+    return static_cast<size_t>((static_cast<uint64_t>(hasher(value)) * 0x9E3779B97F4A7C15ull) >> shift) & mask;
+  }
+
+  size_t Find(const Type& value) const {
+    size_t pos = GetHome(value);
+    for (uint8_t distance = 1; distances[pos] >= distance; ++distance) {
+      if (values[pos] == value) {
+        return pos;
+      }
+      pos = (pos + 1) & mask;
+    }
+    return NOT_FOUND;
+  }
+
+  // The value must not be in the set yet
+  void Insert(Type value) {
+    size_t pos = GetHome(value);
+    uint8_t distance = 1;
+    while (distances[pos] != 0) {
+      if (distances[pos] < distance) {
+        swap(distances[pos], distance);
+        swap(values[pos], value);
+      }
+      pos = (pos + 1) & mask;
+      if (++distance == MAX_DISTANCE) {
+        // The value in hand may be one that was displaced, it is not in the table now
+        Grow();
+        Insert(move(value));
+        return;
+      }
+    }
+    distances[pos] = distance;
+    values[pos] = move(value);
+    ++size;
+  }
+
+  void Grow() {
+    vector<uint8_t> old_distances = move(distances);
+    vector<Type> old_values = move(values);
+    Reset(old_values.size() * 2);
+    for (size_t i = 0; i < old_values.size(); ++i) {
+      if (old_distances[i] != 0) {
+        Insert(move(old_values[i]));
+      }
+    }
+  }
+};
+
 struct IntHasher {
   size_t operator()(int value) const {
     // Это реальная хеш-функция из libc++, libstdc++.
@@ -132,11 +270,164 @@ void TestEquivalence() {
   ASSERT_EQUAL(2, bucket.front().value);
 }
 
-int main() {
+void TestFlatSmoke() {
+  FlatHashSet<int, IntHasher> hash_set(2);
+  hash_set.Add(3);
+  hash_set.Add(4);
+
+  ASSERT(hash_set.Has(3));
+  ASSERT(hash_set.Has(4));
+  ASSERT(!hash_set.Has(5));
+
+  hash_set.Erase(3);
+
+  ASSERT(!hash_set.Has(3));
+  ASSERT(hash_set.Has(4));
+  ASSERT(!hash_set.Has(5));
+
+  hash_set.Add(3);
+  hash_set.Add(5);
+
+  ASSERT(hash_set.Has(3));
+  ASSERT(hash_set.Has(4));
+  ASSERT(hash_set.Has(5));
+  ASSERT_EQUAL(hash_set.Size(), 3u);
+}
+
+void TestFlatIdempotencyAndEquivalence() {
+  FlatHashSet<int, IntHasher> hash_set;
+  hash_set.Add(5);
+  hash_set.Add(5);
+  ASSERT(hash_set.Has(5));
+  ASSERT_EQUAL(hash_set.Size(), 1u);
+  hash_set.Erase(5);
+  hash_set.Erase(5);
+  ASSERT(!hash_set.Has(5));
+  ASSERT_EQUAL(hash_set.Size(), 0u);
+
+  FlatHashSet<TestValue, TestValueHasher> test_values;
+  test_values.Add(TestValue{2});
+  test_values.Add(TestValue{3});
+  ASSERT_EQUAL(test_values.Size(), 1u);
+  ASSERT(test_values.Has(TestValue{3}));
+}
+
+void TestFlatGrowth() {
+  // Multiples of a power of two all land in one bucket without the hash mixing
+  FlatHashSet<int, IntHasher> hash_set;
+  for (int value = 0; value < 100000; ++value) {
+    hash_set.Add(value * 1024);
+  }
+  ASSERT_EQUAL(hash_set.Size(), 100000u);
+  for (int value = 0; value < 100000; ++value) {
+    ASSERT(hash_set.Has(value * 1024));
+    ASSERT(!hash_set.Has(value * 1024 + 1));
+  }
+}
+
+void TestFlatRandomAgainstStd() {
+  mt19937 gen(42);
+  uniform_int_distribution<int> value_dist(0, 2000);
+  uniform_int_distribution<int> op_dist(0, 2);
+  FlatHashSet<int, IntHasher> hash_set;
+  unordered_set<int> expected;
+  for (int i = 0; i < 200000; ++i) {
+    const int value = value_dist(gen);
+    switch (op_dist(gen)) {
+      case 0:
+        hash_set.Add(value);
+        expected.insert(value);
+        break;
+      case 1:
+        hash_set.Erase(value);
+        expected.erase(value);
+        break;
+      default:
+        ASSERT_EQUAL(hash_set.Has(value), expected.count(value) > 0);
+    }
+    ASSERT_EQUAL(hash_set.Size(), expected.size());
+  }
+}
+
+template <typename Set>
+size_t RunSetWorkload(Set& set, const vector<int>& values, const vector<int>& queries) {
+  for (int value : values) {
+    set.Add(value);
+  }
+  size_t found = 0;
+  for (int query : queries) {
+    found += set.Has(query);
+  }
+  for (size_t i = 0; i < values.size(); i += 2) {
+    set.Erase(values[i]);
+  }
+  for (int query : queries) {
+    found += set.Has(query);
+  }
+  return found;
+}
+
+struct StdHashSet {
+  unordered_set<int> data;
+
+  void Add(int value) { data.insert(value); }
+  bool Has(int value) const { return data.count(value) > 0; }
+  void Erase(int value) { data.erase(value); }
+};
+
+void BenchmarkHashSets() {
+  const int value_count = 1000000;
+  mt19937 gen(7);
+  uniform_int_distribution<int> dist(0, 4 * value_count);
+  vector<int> values(value_count);
+  vector<int> queries(4 * value_count);
+  for (int& value : values) {
+    value = dist(gen);
+  }
+  for (int& query : queries) {
+    query = dist(gen);
+  }
+
+  size_t chained_found = 0;
+  size_t flat_found = 0;
+  size_t std_found = 0;
+  {
+    LOG_DURATION("HashSet, forward_list buckets");
+    HashSet<int, IntHasher> set(value_count);
+    chained_found = RunSetWorkload(set, values, queries);
+  }
+  {
+    // The bucket count is fixed, so the lists grow with the set
+    LOG_DURATION("HashSet, 10 values per bucket");
+    HashSet<int, IntHasher> set(value_count / 10);
+    ASSERT_EQUAL(RunSetWorkload(set, values, queries), chained_found);
+  }
+  {
+    LOG_DURATION("FlatHashSet, growing from empty");
+    FlatHashSet<int, IntHasher> set;
+    flat_found = RunSetWorkload(set, values, queries);
+  }
+  {
+    LOG_DURATION("std::unordered_set");
+    StdHashSet set;
+    std_found = RunSetWorkload(set, values, queries);
+  }
+  ASSERT_EQUAL(flat_found, chained_found);
+  ASSERT_EQUAL(std_found, chained_found);
+}
+
+int main(int argc, char* argv[]) {
   TestRunner tr;
   RUN_TEST(tr, TestSmoke);
   RUN_TEST(tr, TestEmpty);
   RUN_TEST(tr, TestIdempotency);
   RUN_TEST(tr, TestEquivalence);
+  RUN_TEST(tr, TestFlatSmoke);
+  RUN_TEST(tr, TestFlatIdempotencyAndEquivalence);
+  RUN_TEST(tr, TestFlatGrowth);
+  RUN_TEST(tr, TestFlatRandomAgainstStd);
+  if (argc > 1 && string_view(argv[1]) == "--benchmark") {
+    RUN_TEST(tr, BenchmarkHashSets);
+  }
   return 0;
 }
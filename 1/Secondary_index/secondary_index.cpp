@@ -1,9 +1,17 @@
 #include "test_runner.h"
+#include "profile.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <random>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <unordered_map>
+#include <vector>
 
 using namespace std;
 
@@ -107,11 +115,274 @@ public:
 
 };
 
+// Secondary index kept as a sorted sequence of (key, slot) entries cut into blocks,
+// like the leaves of a B+ tree: the first entry of every block is kept in a separate
+// array to binary search, and a range scan walks contiguous entries.
+// Entries with equal keys come in slot order.
+template <typename Key>
+class BlockedIndex {
+public:
+  struct Entry {
+    Key key;
+    uint32_t slot;
+
+    bool operator<(const Entry& other) const {
+      return tie(key, slot) < tie(other.key, other.slot);
+    }
+    bool operator==(const Entry& other) const {
+      return key == other.key && slot == other.slot;
+    }
+  };
+
+  void Insert(const Entry& entry) {
+    if (blocks.empty()) {
+      blocks.push_back({entry});
+      block_fronts.push_back(entry);
+      return;
+    }
+    const size_t block_index = FindBlock(entry);
+    vector<Entry>& block = blocks[block_index];
+    block.insert(lower_bound(block.begin(), block.end(), entry), entry);
+    block_fronts[block_index] = block.front();
+
+    if (block.size() > MAX_BLOCK_SIZE) {
+      vector<Entry> upper_half(block.begin() + block.size() / 2, block.end());
+      block.resize(block.size() / 2);
+      block_fronts.insert(block_fronts.begin() + block_index + 1, upper_half.front());
+      blocks.insert(blocks.begin() + block_index + 1, move(upper_half));
+    }
+  }
+
+  void Erase(const Entry& entry) {
+    if (blocks.empty()) {
+      return;
+    }
+    const size_t block_index = FindBlock(entry);
+    vector<Entry>& block = blocks[block_index];
+    auto it = lower_bound(block.begin(), block.end(), entry);
+    if (it == block.end() || !(*it == entry)) {
+      return;
+    }
+    block.erase(it);
+    if (block.empty()) {
+      blocks.erase(blocks.begin() + block_index);
+      block_fronts.erase(block_fronts.begin() + block_index);
+    } else {
+      block_fronts[block_index] = block.front();
+    }
+  }
+
+  // Merges a batch of entries in one pass instead of inserting them one by one.
+  void InsertBulk(vector<Entry> entries) {
+    sort(entries.begin(), entries.end());
+    vector<Entry> merged;
+    merged.reserve(GetSize() + entries.size());
+    for (const auto& block : blocks) {
+      merged.insert(merged.end(), block.begin(), block.end());
+    }
+    const size_t middle = merged.size();
+    merged.insert(merged.end(), entries.begin(), entries.end());
+    inplace_merge(merged.begin(), merged.begin() + middle, merged.end());
+
+    // Blocks are left partly empty to take later inserts without splitting at once
+    blocks.clear();
+    block_fronts.clear();
+    for (size_t begin = 0; begin < merged.size(); begin += BULK_BLOCK_SIZE) {
+      const size_t end = min(begin + BULK_BLOCK_SIZE, merged.size());
+      blocks.emplace_back(merged.begin() + begin, merged.begin() + end);
+      block_fronts.push_back(merged[begin]);
+    }
+  }
+
+  // Calls callback(slot) for the entries with low <= key <= high until it returns false
+  template <typename Callback>
+  void ForRange(const Key& low, const Key& high, Callback callback) const {
+    if (blocks.empty()) {
+      return;
+    }
+    const Entry first{low, 0};
+    size_t block_index = FindBlock(first);
+    auto it = lower_bound(blocks[block_index].begin(), blocks[block_index].end(), first);
+    for (; block_index < blocks.size(); ++block_index) {
+      const vector<Entry>& block = blocks[block_index];
+      for (; it != block.end(); ++it) {
+        if (high < it->key || !callback(it->slot)) {
+          return;
+        }
+      }
+      if (block_index + 1 < blocks.size()) {
+        it = blocks[block_index + 1].begin();
+      }
+    }
+  }
+
+  size_t GetSize() const {
+    size_t size = 0;
+    for (const auto& block : blocks) {
+      size += block.size();
+    }
+    return size;
+  }
+
+private:
+  static const size_t MAX_BLOCK_SIZE = 256;
+  static const size_t BULK_BLOCK_SIZE = MAX_BLOCK_SIZE * 3 / 4;
+
+  vector<vector<Entry>> blocks;
+  vector<Entry> block_fronts;
+
+  // The last block starting not after the entry, or the first one
+  size_t FindBlock(const Entry& entry) const {
+    const auto it = upper_bound(block_fronts.begin(), block_fronts.end(), entry);
+    return it == block_fronts.begin() ? 0 : it - block_fronts.begin() - 1;
+  }
+};
+
+// Same interface as Database with different storage: records live in a slab of
+// fixed-size arrays (addresses stay valid while the slab grows, freed slots are reused),
+// the secondary indexes are BlockedIndexes of slot numbers, and the id index points
+// into the slab too. PutBulk loads a batch of records with one merge per index.
+class SlabDatabase {
+public:
+  bool Put(const Record& record) {
+    if (id_slots.count(record.id)) {
+      return false;
+    }
+    const uint32_t slot = StoreRecord(record);
+    const Record& stored = GetRecord(slot);
+    time_index.Insert({stored.timestamp, slot});
+    karma_index.Insert({stored.karma, slot});
+    user_index.Insert({IndexUser(slot), slot});
+    return true;
+  }
+
+  // Returns the number of records added, the ones with ids already taken are skipped
+  size_t PutBulk(const vector<Record>& records) {
+    vector<BlockedIndex<int>::Entry> time_entries;
+    vector<BlockedIndex<int>::Entry> karma_entries;
+    vector<BlockedIndex<uint32_t>::Entry> user_entries;
+    time_entries.reserve(records.size());
+    karma_entries.reserve(records.size());
+    user_entries.reserve(records.size());
+    id_slots.reserve(id_slots.size() + records.size());
+
+    for (const Record& record : records) {
+      if (id_slots.count(record.id)) {
+        continue;
+      }
+      const uint32_t slot = StoreRecord(record);
+      const Record& stored = GetRecord(slot);
+      time_entries.push_back({stored.timestamp, slot});
+      karma_entries.push_back({stored.karma, slot});
+      user_entries.push_back({IndexUser(slot), slot});
+    }
+    const size_t added = time_entries.size();
+    time_index.InsertBulk(move(time_entries));
+    karma_index.InsertBulk(move(karma_entries));
+    user_index.InsertBulk(move(user_entries));
+    return added;
+  }
+
+  const Record* GetById(const string& id) const {
+    const auto it = id_slots.find(id);
+    return it == id_slots.end() ? nullptr : &GetRecord(it->second);
+  }
+
+  bool Erase(const string& id) {
+    const auto it = id_slots.find(id);
+    if (it == id_slots.end()) {
+      return false;
+    }
+    const uint32_t slot = it->second;
+    Record& record = GetRecord(slot);
+    time_index.Erase({record.timestamp, slot});
+    karma_index.Erase({record.karma, slot});
+    user_index.Erase({slot_users[slot], slot});
+    id_slots.erase(it);
+    record = {};
+    free_slots.push_back(slot);
+    return true;
+  }
+
+  template <typename Callback>
+  void RangeByTimestamp(int low, int high, Callback callback) const {
+    time_index.ForRange(low, high, [&](uint32_t slot) { return callback(GetRecord(slot)); });
+  }
+
+  template <typename Callback>
+  void RangeByKarma(int low, int high, Callback callback) const {
+    karma_index.ForRange(low, high, [&](uint32_t slot) { return callback(GetRecord(slot)); });
+  }
+
+  template <typename Callback>
+  void AllByUser(const string& user, Callback callback) const {
+    const auto it = user_ids.find(user);
+    if (it != user_ids.end()) {
+      user_index.ForRange(it->second, it->second, [&](uint32_t slot) { return callback(GetRecord(slot)); });
+    }
+  }
+
+private:
+  static const size_t SLAB_BLOCK_SIZE = 4096;
+
+  vector<unique_ptr<Record[]>> slab;
+  uint32_t slot_count = 0;
+  vector<uint32_t> free_slots;
+  // Keys are the ids of the records in the slab
+  unordered_map<string_view, uint32_t> id_slots;
+  BlockedIndex<int> time_index;
+  BlockedIndex<int> karma_index;
+  // Users are indexed by number: comparing strings would mean a cache miss per comparison
+  unordered_map<string, uint32_t> user_ids;
+  BlockedIndex<uint32_t> user_index;
+  vector<uint32_t> slot_users;
+
+  Record& GetRecord(uint32_t slot) {
+    return slab[slot / SLAB_BLOCK_SIZE][slot % SLAB_BLOCK_SIZE];
+  }
+
+  const Record& GetRecord(uint32_t slot) const {
+    return slab[slot / SLAB_BLOCK_SIZE][slot % SLAB_BLOCK_SIZE];
+  }
+
+  uint32_t GetUserId(const string& user) {
+    return user_ids.emplace(user, user_ids.size()).first->second;
+  }
+
+  // Keeps the user id of the slot for Erase
+  uint32_t IndexUser(uint32_t slot) {
+    const uint32_t user_id = GetUserId(GetRecord(slot).user);
+    if (slot_users.size() <= slot) {
+      slot_users.resize(slot + 1);
+    }
+    slot_users[slot] = user_id;
+    return user_id;
+  }
+
+  uint32_t StoreRecord(const Record& record) {
+    uint32_t slot;
+    if (!free_slots.empty()) {
+      slot = free_slots.back();
+      free_slots.pop_back();
+    } else {
+      if (slot_count % SLAB_BLOCK_SIZE == 0) {
+        slab.push_back(make_unique<Record[]>(SLAB_BLOCK_SIZE));
+      }
+      slot = slot_count++;
+    }
+    Record& stored = GetRecord(slot);
+    stored = record;
+    id_slots.emplace(stored.id, slot);
+    return slot;
+  }
+};
+
+template <typename DB>
 void TestRangeBoundaries() {
   const int good_karma = 1000;
   const int bad_karma = -10;
 
-  Database db;
+  DB db;
   db.Put({"id1", "Hello there", "master", 1536107260, good_karma});
   db.Put({"id2", "O>>-<", "general2", 1536107260, bad_karma});
 
@@ -124,8 +395,9 @@ void TestRangeBoundaries() {
   ASSERT_EQUAL(2, count);
 }
 
+template <typename DB>
 void TestSameUser() {
-  Database db;
+  DB db;
   db.Put({"id1", "Don't sell", "master", 1536107260, 1000});
   db.Put({"id2", "Rethink life", "master", 1536107260, 2000});
 
@@ -138,10 +410,11 @@ void TestSameUser() {
   ASSERT_EQUAL(2, count);
 }
 
+template <typename DB>
 void TestReplacement() {
   const string final_body = "Feeling sad";
 
-  Database db;
+  DB db;
   db.Put({"id", "Have a hand", "not-master", 1536107260, 10});
   db.Erase("id");
   db.Put({"id", final_body, "not-master", 1536107260, -10});
@@ -151,10 +424,176 @@ void TestReplacement() {
   ASSERT_EQUAL(final_body, record->title);
 }
 
-int main() {
+vector<Record> GenerateRecords(int count, int user_count, int seed) {
+  mt19937 gen(seed);
+  uniform_int_distribution<int> timestamp_dist(1500000000, 1500000000 + count);
+  uniform_int_distribution<int> karma_dist(-1000, 1000);
+  uniform_int_distribution<int> user_dist(0, user_count - 1);
+  vector<Record> records;
+  records.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    records.push_back({"id" + to_string(seed) + "_" + to_string(i), "Title " + to_string(i),
+                       "user" + to_string(user_dist(gen)), timestamp_dist(gen), karma_dist(gen)});
+  }
+  return records;
+}
+
+// Ids of the records found, sorted: the engines differ in the order of records with equal keys
+template <typename DB>
+vector<string> CollectKarma(const DB& db, int low, int high) {
+  vector<string> ids;
+  db.RangeByKarma(low, high, [&ids](const Record& record) {
+    ids.push_back(record.id);
+    return true;
+  });
+  sort(ids.begin(), ids.end());
+  return ids;
+}
+
+template <typename DB>
+vector<string> CollectUser(const DB& db, const string& user) {
+  vector<string> ids;
+  db.AllByUser(user, [&ids](const Record& record) {
+    ids.push_back(record.id);
+    return true;
+  });
+  sort(ids.begin(), ids.end());
+  return ids;
+}
+
+void TestSlabAgainstDatabase() {
+  const vector<Record> records = GenerateRecords(20000, 50, 1);
+  Database expected;
+  SlabDatabase db;
+  // Half by one, half in a batch with a duplicate id
+  for (size_t i = 0; i < records.size() / 2; ++i) {
+    ASSERT_EQUAL(db.Put(records[i]), expected.Put(records[i]));
+  }
+  vector<Record> batch(records.begin() + records.size() / 2, records.end());
+  batch.push_back(records[0]);
+  for (const Record& record : batch) {
+    expected.Put(record);
+  }
+  ASSERT_EQUAL(db.PutBulk(batch), records.size() / 2);
+  ASSERT(!db.Put(records[1]));
+
+  for (size_t i = 0; i < records.size(); i += 3) {
+    ASSERT_EQUAL(db.Erase(records[i].id), expected.Erase(records[i].id));
+  }
+  ASSERT(!db.Erase(records[0].id));
+  // Reuses the freed slots
+  for (size_t i = 0; i < records.size(); i += 6) {
+    ASSERT_EQUAL(db.Put(records[i]), expected.Put(records[i]));
+  }
+
+  for (const Record& record : records) {
+    const Record* found = db.GetById(record.id);
+    const Record* expected_found = expected.GetById(record.id);
+    ASSERT_EQUAL(found != nullptr, expected_found != nullptr);
+    if (found) {
+      ASSERT(*found == *expected_found);
+    }
+  }
+  for (int low = -1000; low <= 1000; low += 97) {
+    ASSERT_EQUAL(CollectKarma(db, low, low + 50), CollectKarma(expected, low, low + 50));
+  }
+  ASSERT_EQUAL(CollectKarma(db, -2000, 2000).size(), CollectKarma(expected, -2000, 2000).size());
+  for (int user = 0; user < 50; user += 7) {
+    ASSERT_EQUAL(CollectUser(db, "user" + to_string(user)), CollectUser(expected, "user" + to_string(user)));
+  }
+  ASSERT(CollectUser(db, "nobody").empty());
+
+  int count = 0;
+  db.RangeByTimestamp(0, 2000000000, [&count](const Record&) {
+    return ++count < 10;
+  });
+  ASSERT_EQUAL(count, 10);
+}
+
+template <typename DB>
+void RunDatabaseQueries(const DB& db, int user_count) {
+  size_t found = 0;
+  for (int low = 1500000000; low < 1500000000 + 1000000; low += 10000) {
+    db.RangeByTimestamp(low, low + 1000, [&found](const Record&) {
+      ++found;
+      return true;
+    });
+  }
+  for (int low = -1000; low < 1000; low += 100) {
+    db.RangeByKarma(low, low + 10, [&found](const Record&) {
+      ++found;
+      return true;
+    });
+  }
+  for (int user = 0; user < user_count; user += 100) {
+    db.AllByUser("user" + to_string(user), [&found](const Record&) {
+      ++found;
+      return true;
+    });
+  }
+  cerr << found << " records found" << endl;
+}
+
+void BenchmarkDatabases() {
+  const int record_count = 2000000;
+  const int user_count = 100000;
+  const vector<Record> records = GenerateRecords(record_count, user_count, 2);
+  {
+    Database db;
+    {
+      LOG_DURATION("Database: Put");
+      for (const Record& record : records) {
+        db.Put(record);
+      }
+    }
+    {
+      LOG_DURATION("Database: range queries");
+      RunDatabaseQueries(db, user_count);
+    }
+    LOG_DURATION("Database: Erase half");
+    for (size_t i = 0; i < records.size(); i += 2) {
+      db.Erase(records[i].id);
+    }
+  }
+  {
+    SlabDatabase db;
+    {
+      LOG_DURATION("SlabDatabase: Put");
+      for (const Record& record : records) {
+        db.Put(record);
+      }
+    }
+    {
+      LOG_DURATION("SlabDatabase: range queries");
+      RunDatabaseQueries(db, user_count);
+    }
+    LOG_DURATION("SlabDatabase: Erase half");
+    for (size_t i = 0; i < records.size(); i += 2) {
+      db.Erase(records[i].id);
+    }
+  }
+  {
+    SlabDatabase db;
+    {
+      LOG_DURATION("SlabDatabase: PutBulk");
+      db.PutBulk(records);
+    }
+    LOG_DURATION("SlabDatabase after PutBulk: range queries");
+    RunDatabaseQueries(db, user_count);
+  }
+}
+
+int main(int argc, char* argv[]) {
   TestRunner tr;
-  RUN_TEST(tr, TestRangeBoundaries);
-  RUN_TEST(tr, TestSameUser);
-  RUN_TEST(tr, TestReplacement);
+  RUN_TEST(tr, TestRangeBoundaries<Database>);
+  RUN_TEST(tr, TestSameUser<Database>);
+  RUN_TEST(tr, TestReplacement<Database>);
+  RUN_TEST(tr, TestRangeBoundaries<SlabDatabase>);
+  RUN_TEST(tr, TestSameUser<SlabDatabase>);
+  RUN_TEST(tr, TestReplacement<SlabDatabase>);
+  RUN_TEST(tr, TestSlabAgainstDatabase);
+  if (argc > 1 && string_view(argv[1]) == "--benchmark") {
+    RUN_TEST(tr, BenchmarkDatabases);
+  }
   return 0;
 }
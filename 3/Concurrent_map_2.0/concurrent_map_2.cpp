@@ -1,23 +1,37 @@
 #include "test_runner.h"
 #include "profile.h"
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <future>
 #include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 #include <utility>
 #include <algorithm>
+#include <array>
 #include <random>
+#include <thread>
 using namespace std;
 
-template <typename K, typename V, typename Hash = std::hash<K>>
+// Keeps neighbouring bucket mutexes from sharing a cache line
+const size_t CACHE_LINE_SIZE = 64;
+
+// With Mutex = shared_mutex, At and Has of one bucket do not wait for each other
+template <typename K, typename V, typename Hash = std::hash<K>, typename Mutex = mutex>
 class ConcurrentMap {
 public:
   using MapType = unordered_map<K, V, Hash>;
 private:
-  struct Bucket {
+  using ReadLock = conditional_t<is_same_v<Mutex, shared_mutex>, shared_lock<Mutex>, unique_lock<Mutex>>;
+
+  struct alignas(CACHE_LINE_SIZE) Bucket {
   	  MapType data;
-  	  mutable mutex m;
+  	  mutable Mutex m;
   };
   vector<Bucket> buckets;
   Hash hasher;
@@ -25,22 +39,22 @@ private:
 
 public:
 
-  struct WriteAccess : lock_guard<mutex> {
+  struct WriteAccess : lock_guard<Mutex> {
     V& ref_to_value;
 
     WriteAccess(const K& key, Bucket& bucket)
-    : lock_guard(bucket.m)
+    : lock_guard<Mutex>(bucket.m)
     , ref_to_value(bucket.data[key])
     {
     }
 
   };
 
-  struct ReadAccess : lock_guard<mutex> {
+  struct ReadAccess : ReadLock {
     const V& ref_to_value;
 
     ReadAccess(const K& key, const Bucket& bucket)
-    : lock_guard(bucket.m)
+    : ReadLock(bucket.m)
     , ref_to_value(bucket.data.at(key))
     {
     }
@@ -62,7 +76,7 @@ public:
 
   bool Has(const K& key) const {
 	  const Bucket& bucket = buckets[GetIndex(key)];
-	  lock_guard g(bucket.m);
+	  ReadLock g(bucket.m);
 	  return bucket.data.count(key) > 0;
   }
 
@@ -70,7 +84,7 @@ public:
 	  MapType result;
 
 	  for(auto& [data, mtx] : buckets) {
-		  lock_guard g(mtx);
+		  ReadLock g(mtx);
 		  result.insert(begin(data), end(data));
 	  }
 
@@ -85,8 +99,492 @@ private:
 
 };
 
+template <typename K, typename V, typename Hash = std::hash<K>>
+using SharedConcurrentMap = ConcurrentMap<K, V, Hash, shared_mutex>;
+
+// Epoch-based reclamation. A thread pins the current epoch for as long as it may hold
+// pointers to shared objects. An object retired in epoch E is freed once every thread
+// that is still pinned has pinned a later epoch, since those threads started after
+// the object had become unreachable.
+class EpochReclaimer {
+public:
+  static EpochReclaimer& Instance() {
+    static EpochReclaimer instance;
+    return instance;
+  }
+
+  // Pins the current thread, guards may be nested
+  class Guard {
+  public:
+    Guard() {
+      Instance().Pin();
+    }
+    ~Guard() {
+      Instance().Unpin();
+    }
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+  };
+
+  // deleter is called once no thread can reach the object
+  void Retire(function<void()> deleter) {
+    {
+      lock_guard g(retired_mutex_);
+      retired_.push_back({global_epoch_.fetch_add(1), move(deleter)});
+      has_retired_ = true;
+    }
+    TryReclaim();
+  }
+
+  ~EpochReclaimer() {
+    for (auto& [epoch, deleter] : retired_) {
+      deleter();
+    }
+    for (ThreadRecord* record = records_.load(); record; ) {
+      delete exchange(record, record->next);
+    }
+  }
+
+private:
+  static const uint64_t QUIESCENT = 0;
+
+  struct alignas(CACHE_LINE_SIZE) ThreadRecord {
+    atomic<uint64_t> epoch = QUIESCENT;
+    atomic<bool> in_use = true;
+    ThreadRecord* next = nullptr;
+  };
+
+  // Returns the record to the pool when its thread exits
+  struct ThreadRecordHolder {
+    ThreadRecord* record = nullptr;
+    int pin_depth = 0;
+
+    ~ThreadRecordHolder() {
+      if (record) {
+        record->in_use = false;
+      }
+    }
+  };
+
+  atomic<uint64_t> global_epoch_ = 1;
+  // Records are reused by later threads and freed only with the reclaimer
+  atomic<ThreadRecord*> records_ = nullptr;
+  mutex retired_mutex_;
+  vector<pair<uint64_t, function<void()>>> retired_;
+  atomic<bool> has_retired_ = false;
+
+  ThreadRecordHolder& GetThreadRecord() {
+    static thread_local ThreadRecordHolder holder;
+    if (!holder.record) {
+      for (ThreadRecord* record = records_.load(); record; record = record->next) {
+        bool in_use = false;
+        if (record->in_use.compare_exchange_strong(in_use, true)) {
+          holder.record = record;
+          return holder;
+        }
+      }
+      holder.record = new ThreadRecord;
+      holder.record->next = records_.load();
+      while (!records_.compare_exchange_weak(holder.record->next, holder.record)) {
+      }
+    }
+    return holder;
+  }
+
+  void Pin() {
+    ThreadRecordHolder& holder = GetThreadRecord();
+    if (holder.pin_depth++ == 0) {
+      holder.record->epoch = global_epoch_.load();
+    }
+  }
+
+  void Unpin() {
+    ThreadRecordHolder& holder = GetThreadRecord();
+    if (--holder.pin_depth == 0) {
+      holder.record->epoch = QUIESCENT;
+      if (has_retired_.load(memory_order_relaxed)) {
+        TryReclaim();
+      }
+    }
+  }
+
+  void TryReclaim() {
+    unique_lock g(retired_mutex_, try_to_lock);
+    if (!g) {
+      return;
+    }
+    uint64_t min_pinned_epoch = UINT64_MAX;
+    for (ThreadRecord* record = records_.load(); record; record = record->next) {
+      const uint64_t epoch = record->epoch.load();
+      if (epoch != QUIESCENT) {
+        min_pinned_epoch = min(min_pinned_epoch, epoch);
+      }
+    }
+    const auto reclaimable = partition(begin(retired_), end(retired_), [min_pinned_epoch](const auto& item) {
+      return item.first >= min_pinned_epoch;
+    });
+    for (auto it = reclaimable; it != end(retired_); ++it) {
+      it->second();
+    }
+    retired_.erase(reclaimable, end(retired_));
+    has_retired_ = !retired_.empty();
+  }
+};
+
+
+// Open addressing with linear probing where every slot is an atomic pointer to a node
+// holding a key and an atomic value. Lookups and updates never lock: a missing key is
+// added with one CAS on an empty slot, and values are changed with atomic operations
+// on the returned reference. Nodes live as long as the map, so the references stay valid.
+// When the table gets half full, a table twice as large is attached, and every thread
+// that meets the old one helps to move it: a slot is frozen by tagging its pointer,
+// its node is copied by whoever sees it frozen, and then the slot is marked as moved.
+// Nobody works in the new table until the old one is moved entirely, so a key is never
+// added twice. Old tables are freed through EpochReclaimer.
+// BuildOrdinaryMap is the one operation that waits: see WriteGuard.
+// V has to fit in an atomic: counters, flags, ids
+template <typename K, typename V, typename Hash = std::hash<K>>
+class LockFreeMap {
+public:
+  using MapType = unordered_map<K, V, Hash>;
+
+  static_assert(is_trivially_copyable_v<V>);
+
+  // Every write access is counted on a stripe of its thread, so that BuildOrdinaryMap
+  // can wait for the open ones to end and keep new ones from starting until it has
+  // read the whole map. Otherwise writers only touch their own stripe
+  class WriteGuard {
+  public:
+    explicit WriteGuard(const LockFreeMap& map)
+    : writer_count_(map.writer_stripes_[GetWriterStripe()].writer_count)
+    {
+      while (true) {
+        writer_count_.fetch_add(1);
+        if (!map.is_snapshotting_.load()) {
+          return;
+        }
+        writer_count_.fetch_sub(1);
+        while (map.is_snapshotting_.load()) {
+          this_thread::yield();
+        }
+      }
+    }
+
+    WriteGuard(const WriteGuard&) = delete;
+    WriteGuard& operator=(const WriteGuard&) = delete;
+
+    ~WriteGuard() {
+      writer_count_.fetch_sub(1);
+    }
+
+  private:
+    atomic<size_t>& writer_count_;
+  };
+
+  struct WriteAccess {
+    // Goes first to be in place before the key is looked up
+    WriteGuard guard;
+    atomic<V>& ref_to_value;
+  };
+
+  struct ReadAccess {
+    const atomic<V>& ref_to_value;
+  };
+
+  explicit LockFreeMap(size_t initial_capacity = 16)
+  : table_(new Table(max<size_t>(initial_capacity, 2)))
+  {
+  }
+
+  LockFreeMap(const LockFreeMap&) = delete;
+  LockFreeMap& operator=(const LockFreeMap&) = delete;
+
+  ~LockFreeMap() {
+    // Old tables go to EpochReclaimer as usual
+    while (table_.load()->next.load()) {
+      MigrateTable(table_.load());
+    }
+    Table* table = table_.load();
+    for (size_t i = 0; i < table->capacity; ++i) {
+      delete table->slots[i].load();
+    }
+    delete table;
+  }
+
+  WriteAccess operator[](const K& key) {
+    EpochReclaimer::Guard guard;
+    return {WriteGuard(*this), GetOrAddNode(key).value};
+  }
+
+  ReadAccess At(const K& key) const {
+    EpochReclaimer::Guard guard;
+    if (const Node* node = FindNode(key)) {
+      return {node->value};
+    }
+    throw out_of_range("LockFreeMap::At");
+  }
+
+  bool Has(const K& key) const {
+    EpochReclaimer::Guard guard;
+    return FindNode(key) != nullptr;
+  }
+
+  // A consistent snapshot: the map is read while no write access is open, and
+  // writers wait until it is done. Readers go on as usual. Like with ConcurrentMap,
+  // the calling thread must not hold a WriteAccess itself
+  MapType BuildOrdinaryMap() const {
+    lock_guard snapshot_guard(snapshot_mutex_);
+    is_snapshotting_ = true;
+    for (const WriterStripe& stripe : writer_stripes_) {
+      while (stripe.writer_count.load() > 0) {
+        this_thread::yield();
+      }
+    }
+    try {
+      MapType result = ReadTables();
+      is_snapshotting_ = false;
+      return result;
+    } catch (...) {
+      is_snapshotting_ = false;
+      throw;
+    }
+  }
+
+private:
+  struct Node {
+    const K key;
+    atomic<V> value;
+  };
+
+  struct Table {
+    const size_t capacity;
+    const int shift;
+    unique_ptr<atomic<Node*>[]> slots;
+    atomic<Table*> next = nullptr;
+
+    explicit Table(size_t min_capacity)
+    : capacity(ComputeCapacity(min_capacity))
+    , shift(64 - ComputeLog2(capacity))
+    , slots(new atomic<Node*>[capacity])
+    {
+      for (size_t i = 0; i < capacity; ++i) {
+        slots[i].store(nullptr, memory_order_relaxed);
+      }
+    }
+
+    size_t GetHome(size_t hash) const {
+      return (uint64_t(hash) * 0x9E3779B97F4A7C15ull) >> shift;
+    }
+
+    static size_t ComputeCapacity(size_t min_capacity) {
+      size_t capacity = 2;
+      while (capacity < min_capacity) {
+        capacity *= 2;
+      }
+      return capacity;
+    }
+
+    static int ComputeLog2(size_t capacity) {
+      int log2 = 0;
+      while ((size_t(1) << log2) < capacity) {
+        ++log2;
+      }
+      return log2;
+    }
+  };
+
+  // Slot states besides empty and a live node: a node being copied has its
+  // lowest bit set, a moved slot holds MOVED
+  static inline Node* const MOVED = reinterpret_cast<Node*>(uintptr_t(2));
+
+  static bool IsFrozen(const Node* node) {
+    return reinterpret_cast<uintptr_t>(node) & 1;
+  }
+  static Node* Freeze(Node* node) {
+    return reinterpret_cast<Node*>(reinterpret_cast<uintptr_t>(node) | 1);
+  }
+  static Node* Unfreeze(Node* node) {
+    return reinterpret_cast<Node*>(reinterpret_cast<uintptr_t>(node) & ~uintptr_t(1));
+  }
+  static bool IsMoving(const Node* node) {
+    return node == MOVED || IsFrozen(node);
+  }
+
+  static const size_t WRITER_STRIPE_COUNT = 32;
+
+  struct alignas(CACHE_LINE_SIZE) WriterStripe {
+    atomic<size_t> writer_count = 0;
+  };
+
+  // Moves on to the next table in const methods too, when they find the current one moved
+  mutable atomic<Table*> table_;
+  atomic<size_t> size_ = 0;
+  Hash hasher_;
+  mutable array<WriterStripe, WRITER_STRIPE_COUNT> writer_stripes_;
+  mutable atomic<bool> is_snapshotting_ = false;
+  // Snapshots are taken one at a time
+  mutable mutex snapshot_mutex_;
+
+  static size_t GetWriterStripe() {
+    static atomic<size_t> next_stripe = 0;
+    static thread_local const size_t stripe = next_stripe++ % WRITER_STRIPE_COUNT;
+    return stripe;
+  }
+
+  const Node* FindNode(const K& key) const {
+    const size_t hash = hasher_(key);
+    Table* table = table_.load();
+    while (true) {
+      bool is_moved = false;
+      const size_t home = table->GetHome(hash);
+      for (size_t step = 0; step < table->capacity; ++step) {
+        const Node* node = table->slots[(home + step) & (table->capacity - 1)].load(memory_order_acquire);
+        if (!node) {
+          return nullptr;
+        }
+        if (IsMoving(node)) {
+          is_moved = true;
+          break;
+        }
+        if (node->key == key) {
+          return node;
+        }
+      }
+      if (!is_moved) {
+        return nullptr;
+      }
+      table = MigrateTable(table);
+    }
+  }
+
+  Node& GetOrAddNode(const K& key) {
+    const size_t hash = hasher_(key);
+    unique_ptr<Node> new_node;
+    Table* table = table_.load();
+    while (true) {
+      const size_t home = table->GetHome(hash);
+      bool is_moved = false;
+      for (size_t step = 0; step < table->capacity && !is_moved; ++step) {
+        atomic<Node*>& slot = table->slots[(home + step) & (table->capacity - 1)];
+        Node* node = slot.load(memory_order_acquire);
+        if (!node) {
+          if (!new_node) {
+            new_node.reset(new Node{key, V()});
+          }
+          if (slot.compare_exchange_strong(node, new_node.get(), memory_order_acq_rel)) {
+            Node& added = *new_node.release();
+            if (2 * (size_.fetch_add(1) + 1) > table->capacity) {
+              StartResize(table);
+            }
+            return added;
+          }
+          // Someone took the slot first, node is what they put there
+        }
+        if (IsMoving(node)) {
+          is_moved = true;
+        } else if (node->key == key) {
+          return *node;
+        }
+      }
+      // Either the table is being moved or it is full
+      if (!is_moved) {
+        StartResize(table);
+      }
+      table = MigrateTable(table);
+    }
+  }
+
+  void StartResize(Table* table) {
+    if (!table->next.load()) {
+      Table* next = new Table(2 * table->capacity);
+      Table* expected = nullptr;
+      if (!table->next.compare_exchange_strong(expected, next)) {
+        delete next;
+      }
+    }
+    MigrateTable(table);
+  }
+
+  // Moves every slot of table to table->next and returns table->next
+  Table* MigrateTable(Table* table) const {
+    Table* next = table->next.load();
+    for (size_t i = 0; i < table->capacity; ++i) {
+      MigrateSlot(table->slots[i], next);
+    }
+    Table* expected = table;
+    if (table_.compare_exchange_strong(expected, next)) {
+      EpochReclaimer::Instance().Retire([table] { delete table; });
+    }
+    return next;
+  }
+
+  void MigrateSlot(atomic<Node*>& slot, Table* next) const {
+    Node* node = slot.load(memory_order_acquire);
+    while (node != MOVED) {
+      if (!node) {
+        slot.compare_exchange_strong(node, MOVED, memory_order_acq_rel);
+      } else if (!IsFrozen(node)) {
+        slot.compare_exchange_strong(node, Freeze(node), memory_order_acq_rel);
+      } else {
+        CopyNode(Unfreeze(node), next);
+        slot.compare_exchange_strong(node, MOVED, memory_order_acq_rel);
+      }
+    }
+  }
+
+  // Adds node unless a node with its key is there already. Threads that copy the same
+  // node race only with each other, so whoever loses finds the same key
+  void CopyNode(Node* node, Table* table) const {
+    const size_t hash = hasher_(node->key);
+    while (true) {
+      const size_t home = table->GetHome(hash);
+      for (size_t step = 0; step < table->capacity; ++step) {
+        atomic<Node*>& slot = table->slots[(home + step) & (table->capacity - 1)];
+        Node* current = slot.load(memory_order_acquire);
+        if (!current && slot.compare_exchange_strong(current, node, memory_order_acq_rel)) {
+          return;
+        }
+        if (IsMoving(current)) {
+          // A slow helper copies into a table that has been moved on already;
+          // the node is in one of the following tables
+          break;
+        }
+        if (current->key == node->key) {
+          return;
+        }
+      }
+      table = MigrateTable(table);
+    }
+  }
+
+  // A resize finished by readers may still be under way, then the scan moves on with it
+  MapType ReadTables() const {
+    EpochReclaimer::Guard guard;
+    MapType result;
+    Table* table = table_.load();
+    while (true) {
+      result.clear();
+      bool is_moved = false;
+      for (size_t i = 0; i < table->capacity && !is_moved; ++i) {
+        Node* node = table->slots[i].load(memory_order_acquire);
+        if (IsMoving(node)) {
+          is_moved = true;
+        } else if (node) {
+          result.emplace(node->key, node->value.load());
+        }
+      }
+      if (!is_moved) {
+        return result;
+      }
+      table = MigrateTable(table);
+    }
+  }
+};
+
+
+template <typename Map>
 void RunConcurrentUpdates(
-    ConcurrentMap<int, int>& cm, size_t thread_count, int key_count
+    Map& cm, size_t thread_count, int key_count
 ) {
   auto kernel = [&cm, key_count](int seed) {
     vector<int> updates(key_count);
@@ -152,6 +650,37 @@ void TestReadAndWrite() {
   }
 }
 
+// Each thread makes operation_count requests to random keys, read_percent of them reads
+template <typename Map>
+void RunConcurrentReadsAndWrites(
+    Map& cm, size_t thread_count, int key_count, int read_percent, int operation_count
+) {
+  auto kernel = [&cm, key_count, read_percent, operation_count](int seed) {
+    mt19937 gen(seed);
+    uniform_int_distribution<int> key_dis(0, key_count - 1);
+    uniform_int_distribution<int> percent_dis(0, 99);
+    const auto& const_cm = as_const(cm);
+    int checksum = 0;
+    for (int i = 0; i < operation_count; ++i) {
+      const int key = key_dis(gen);
+      if (percent_dis(gen) < read_percent) {
+        checksum += const_cm.At(key).ref_to_value;
+      } else {
+        cm[key].ref_to_value++;
+      }
+    }
+    return checksum;
+  };
+
+  vector<future<int>> futures;
+  for (size_t i = 0; i < thread_count; ++i) {
+    futures.push_back(async(launch::async, kernel, i));
+  }
+  for (auto& f : futures) {
+    f.get();
+  }
+}
+
 void TestSpeedup() {
   {
     ConcurrentMap<int, int> single_lock(1);
@@ -165,6 +694,56 @@ void TestSpeedup() {
     LOG_DURATION("100 locks");
     RunConcurrentUpdates(many_locks, 4, 50000);
   }
+
+  const int key_count = 10000;
+  const int operations_per_thread = 200000;
+  for (int read_percent : {50, 95, 99}) {
+    for (size_t thread_count : {1, 2, 4, 8}) {
+      const string suffix = ", " + to_string(read_percent) + "% reads, "
+          + to_string(thread_count) + " threads";
+      {
+        ConcurrentMap<int, int> cm(16);
+        for (int key = 0; key < key_count; ++key) {
+          cm[key].ref_to_value = 0;
+        }
+        LOG_DURATION("mutex" + suffix);
+        RunConcurrentReadsAndWrites(cm, thread_count, key_count, read_percent, operations_per_thread);
+      }
+      {
+        SharedConcurrentMap<int, int> cm(16);
+        for (int key = 0; key < key_count; ++key) {
+          cm[key].ref_to_value = 0;
+        }
+        LOG_DURATION("shared_mutex" + suffix);
+        RunConcurrentReadsAndWrites(cm, thread_count, key_count, read_percent, operations_per_thread);
+      }
+    }
+  }
+}
+
+void TestSharedMap() {
+  const int key_count = 10000;
+  SharedConcurrentMap<int, int> cm(4);
+
+  auto reader = async(launch::async, [&cm] {
+    const auto& const_map = as_const(cm);
+    for (int round = 0; round < 10; ++round) {
+      for (int key = -key_count / 2; key < key_count / 2; ++key) {
+        if (const_map.Has(key)) {
+          const int value = const_map.At(key).ref_to_value;
+          ASSERT(0 <= value && value <= 6);
+        }
+      }
+    }
+  });
+  RunConcurrentUpdates(cm, 3, key_count);
+  reader.get();
+
+  const auto result = as_const(cm).BuildOrdinaryMap();
+  ASSERT_EQUAL(result.size(), size_t(key_count));
+  for (auto& [k, v] : result) {
+    AssertEqual(v, 6, "Key = " + to_string(k));
+  }
 }
 
 void TestConstAccess() {
@@ -267,6 +846,177 @@ void TestHas() {
   ASSERT(!const_map.Has(3));
 }
 
+void TestLockFreeConcurrentUpdate() {
+  const size_t thread_count = 4;
+  const size_t key_count = 50000;
+
+  // Starts tiny, so that the table is resized while all threads update it
+  LockFreeMap<int, int> cm(2);
+  RunConcurrentUpdates(cm, thread_count, key_count);
+
+  const auto result = cm.BuildOrdinaryMap();
+  ASSERT_EQUAL(result.size(), key_count);
+  for (auto& [k, v] : result) {
+    AssertEqual(v, 8, "Key = " + to_string(k));
+  }
+}
+
+void TestLockFreeReadersDuringResize() {
+  const int key_count = 100000;
+  LockFreeMap<int, int> cm(2);
+
+  auto reader = [&cm] {
+    // Once seen, a key must stay visible with its value through every resize
+    int checked_count = 0;
+    while (checked_count < key_count) {
+      int visible_count = checked_count;
+      while (visible_count < key_count && cm.Has(visible_count)) {
+        ++visible_count;
+      }
+      // A key followed by a visible key has got its value already
+      for (; checked_count + 1 < visible_count; ++checked_count) {
+        ASSERT_EQUAL(cm.At(checked_count).ref_to_value.load(), checked_count + 1);
+      }
+      // The newest key may still hold the zero it was added with
+      if (checked_count < visible_count) {
+        const int value = cm.At(checked_count).ref_to_value.load();
+        ASSERT(value == 0 || value == checked_count + 1);
+        if (value != 0) {
+          ++checked_count;
+        }
+      }
+      for (int key = 0; key < checked_count; key += 97) {
+        ASSERT(cm.Has(key));
+      }
+    }
+  };
+  auto r1 = async(launch::async, reader);
+  auto r2 = async(launch::async, reader);
+  for (int key = 0; key < key_count; ++key) {
+    // The value is set before the next key is added
+    cm[key].ref_to_value = key + 1;
+  }
+  r1.get();
+  r2.get();
+}
+
+void TestLockFreeUserType() {
+  LockFreeMap<Point, size_t, PointHash> point_weight;
+
+  vector<future<void>> futures;
+  for (int i = 0; i < 1000; ++i) {
+    futures.push_back(async([&point_weight, i] {
+      point_weight[Point{i, i}].ref_to_value += i;
+      point_weight[Point{0, 0}].ref_to_value++;
+    }));
+  }
+
+  futures.clear();
+
+  for (int i = 1; i < 1000; ++i) {
+    ASSERT_EQUAL(point_weight.At(Point{i, i}).ref_to_value.load(), size_t(i));
+  }
+  ASSERT_EQUAL(point_weight.At(Point{0, 0}).ref_to_value.load(), size_t(1000));
+  ASSERT_EQUAL(point_weight.BuildOrdinaryMap().size(), size_t(1000));
+}
+
+void TestLockFreeHas() {
+  LockFreeMap<int, int> cm;
+  cm[1].ref_to_value = 100;
+  cm[2].ref_to_value = 200;
+
+  const auto& const_map = std::as_const(cm);
+  ASSERT(const_map.Has(1));
+  ASSERT(const_map.Has(2));
+  ASSERT(!const_map.Has(3));
+  ASSERT_EQUAL(const_map.At(2).ref_to_value.load(), 200);
+  try {
+    const_map.At(3);
+    ASSERT(false);
+  } catch (out_of_range&) {
+  }
+}
+
+void TestLockFreeSnapshot() {
+  const int key_count = 200000;
+  const int writer_count = 2;
+  const int sweep_count = 5;
+
+  LockFreeMap<int, int> cm;
+  atomic<int> finished_count = 0;
+  auto writer = [&cm, &finished_count] {
+    // Keys are added and incremented in increasing order, so at any moment the
+    // keys present are 0..n-1 and their values do not grow with the key
+    for (int sweep = 0; sweep < sweep_count; ++sweep) {
+      for (int key = 0; key < key_count; ++key) {
+        cm[key].ref_to_value++;
+      }
+    }
+    ++finished_count;
+  };
+  vector<future<void>> writers;
+  for (int i = 0; i < writer_count; ++i) {
+    writers.push_back(async(launch::async, writer));
+  }
+
+  int snapshot_count = 0;
+  while (finished_count < writer_count || snapshot_count == 0) {
+    const auto snapshot = cm.BuildOrdinaryMap();
+    ++snapshot_count;
+    const int size = snapshot.size();
+    for (int key = 0; key < size; ++key) {
+      ASSERT(snapshot.count(key));
+      if (key > 0) {
+        ASSERT(snapshot.at(key) <= snapshot.at(key - 1));
+      }
+    }
+    if (size > 0) {
+      // Every writer is at most one sweep ahead at the smallest key
+      ASSERT(snapshot.at(0) - snapshot.at(size - 1) <= writer_count);
+    }
+  }
+  writers.clear();
+
+  const auto result = cm.BuildOrdinaryMap();
+  ASSERT_EQUAL(result.size(), size_t(key_count));
+  for (const auto& [key, value] : result) {
+    ASSERT_EQUAL(value, writer_count * sweep_count);
+  }
+}
+
+void BenchmarkLockFreeMap() {
+  const int key_count = 50000;
+  for (size_t thread_count : {1, 2, 4, 8, 16, 32}) {
+    const string suffix = ", " + to_string(thread_count) + " threads";
+    {
+      ConcurrentMap<int, int> cm(100);
+      LOG_DURATION("ConcurrentMap updates" + suffix);
+      RunConcurrentUpdates(cm, thread_count, key_count);
+    }
+    {
+      LockFreeMap<int, int> cm;
+      LOG_DURATION("LockFreeMap updates" + suffix);
+      RunConcurrentUpdates(cm, thread_count, key_count);
+    }
+    {
+      ConcurrentMap<int, int> cm(100);
+      for (int key = 0; key < key_count; ++key) {
+        cm[key].ref_to_value = 0;
+      }
+      LOG_DURATION("ConcurrentMap, 95% reads" + suffix);
+      RunConcurrentReadsAndWrites(cm, thread_count, key_count, 95, 100000);
+    }
+    {
+      LockFreeMap<int, int> cm;
+      for (int key = 0; key < key_count; ++key) {
+        cm[key].ref_to_value = 0;
+      }
+      LOG_DURATION("LockFreeMap, 95% reads" + suffix);
+      RunConcurrentReadsAndWrites(cm, thread_count, key_count, 95, 100000);
+    }
+  }
+}
+
 int main() {
   TestRunner tr;
   RUN_TEST(tr, TestConcurrentUpdate);
@@ -276,4 +1026,11 @@ int main() {
   RUN_TEST(tr, TestStringKeys);
   RUN_TEST(tr, TestUserType);
   RUN_TEST(tr, TestHas);
+  RUN_TEST(tr, TestSharedMap);
+  RUN_TEST(tr, TestLockFreeConcurrentUpdate);
+  RUN_TEST(tr, TestLockFreeReadersDuringResize);
+  RUN_TEST(tr, TestLockFreeUserType);
+  RUN_TEST(tr, TestLockFreeHas);
+  RUN_TEST(tr, TestLockFreeSnapshot);
+  RUN_TEST(tr, BenchmarkLockFreeMap);
 }
@@ -1,31 +1,65 @@
 #include "../../test_runner.h"
 
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 using namespace std;
 
+// Computes the value on the first Get and keeps it. Get may be called from several
+// threads: the initializer runs exactly once, the other threads wait for it, and
+// after that Get only checks an atomic flag. If the initializer throws, the next
+// Get tries again. The initializer and everything it captured are destroyed as soon
+// as the value is there
 template <typename T>
 class LazyValue {
 public:
-  explicit LazyValue(std::function<T()> init) {
-	  f = init;
+  explicit LazyValue(function<T()> init)
+  : init(move(init))
+  {
   }
 
   bool HasValue() const {
-	  return value.has_value();
+    return is_ready.load(memory_order_acquire);
   }
 
   const T& Get() const {
-	  if (!value) {
-		  value = f();
-		  return value.value();
-	  }
-	  return *value;
+    if (!is_ready.load(memory_order_acquire)) {
+      lock_guard g(init_mutex);
+      if (!is_ready.load(memory_order_relaxed)) {
+        value.emplace(init());
+        init = nullptr;
+        is_ready.store(true, memory_order_release);
+      }
+    }
+    return *value;
+  }
+
+  // Starts the initializer on a background thread, so that a later Get finds
+  // the value ready or waits only for the rest of it
+  void Prefetch() {
+    lock_guard g(init_mutex);
+    if (!is_ready.load(memory_order_relaxed) && !prefetch.valid()) {
+      prefetch = async(launch::async, [this] { Get(); });
+    }
   }
 
 private:
-mutable optional<T> value;
-function<T()> f;
+  mutable optional<T> value;
+  mutable function<T()> init;
+  // Guards the initialization only, Get does not touch it once the value is ready
+  mutable mutex init_mutex;
+  mutable atomic<bool> is_ready = false;
+  // Declared last to be destroyed first: waits for the background thread
+  // before the rest of the object goes away
+  future<void> prefetch;
 };
 
 void UseExample() {
@@ -50,9 +84,88 @@ void TestInitializerIsntCalled() {
   ASSERT(!called);
 }
 
+void TestConcurrentGet() {
+  atomic<int> call_count = 0;
+  LazyValue<string> lazy_string([&call_count] {
+    ++call_count;
+    this_thread::sleep_for(chrono::milliseconds(50));
+    return string("loaded");
+  });
+
+  vector<future<const string*>> readers;
+  for (int i = 0; i < 8; ++i) {
+    readers.push_back(async(launch::async, [&lazy_string] {
+      return &lazy_string.Get();
+    }));
+  }
+  for (auto& reader : readers) {
+    const string* result = reader.get();
+    ASSERT_EQUAL(*result, "loaded");
+    ASSERT_EQUAL(result, &lazy_string.Get());
+  }
+  ASSERT_EQUAL(call_count.load(), 1);
+}
+
+void TestPrefetch() {
+  atomic<int> call_count = 0;
+  LazyValue<int> lazy_int([&call_count] {
+    ++call_count;
+    this_thread::sleep_for(chrono::milliseconds(20));
+    return 42;
+  });
+
+  lazy_int.Prefetch();
+  lazy_int.Prefetch();
+  ASSERT_EQUAL(lazy_int.Get(), 42);
+  ASSERT(lazy_int.HasValue());
+  ASSERT_EQUAL(call_count.load(), 1);
+
+  // Destroying a value that is still being prefetched waits for it
+  {
+    LazyValue<int> unused([&call_count] {
+      this_thread::sleep_for(chrono::milliseconds(20));
+      return ++call_count;
+    });
+    unused.Prefetch();
+  }
+  ASSERT_EQUAL(call_count.load(), 2);
+}
+
+void TestInitializerIsReleased() {
+  auto resource = make_shared<string>("Giant amounts of memory");
+  LazyValue<size_t> lazy_size([resource] { return resource->size(); });
+  ASSERT_EQUAL(resource.use_count(), 2);
+
+  ASSERT_EQUAL(lazy_size.Get(), resource->size());
+  ASSERT_EQUAL(resource.use_count(), 1);
+}
+
+void TestInitializerThrows() {
+  int call_count = 0;
+  LazyValue<int> lazy_int([&call_count] {
+    if (++call_count == 1) {
+      throw runtime_error("not yet");
+    }
+    return call_count;
+  });
+
+  try {
+    lazy_int.Get();
+    ASSERT(false);
+  } catch (const runtime_error&) {
+  }
+  ASSERT(!lazy_int.HasValue());
+  ASSERT_EQUAL(lazy_int.Get(), 2);
+  ASSERT_EQUAL(lazy_int.Get(), 2);
+}
+
 int main() {
   TestRunner tr;
   RUN_TEST(tr, UseExample);
   RUN_TEST(tr, TestInitializerIsntCalled);
+  RUN_TEST(tr, TestConcurrentGet);
+  RUN_TEST(tr, TestPrefetch);
+  RUN_TEST(tr, TestInitializerIsReleased);
+  RUN_TEST(tr, TestInitializerThrows);
   return 0;
 }
@@ -1,39 +1,285 @@
 #include "test_runner.h"
+#include "profile.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iterator>
+#include <memory>
 #include <numeric>
+#include <optional>
 #include <vector>
 #include <string>
 #include <future>
 #include <mutex>
 #include <queue>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
 using namespace std;
 
 template <typename T>
 class Synchronized {
+    // Wakes up threads blocked in Wait when a write access ends
+    class Notifier {
+    public:
+        explicit Notifier(const Synchronized* owner) : owner_(owner) {}
+        Notifier(Notifier&& other) : owner_(exchange(other.owner_, nullptr)) {}
+        Notifier(const Notifier&) = delete;
+        Notifier& operator=(const Notifier&) = delete;
+        Notifier& operator=(Notifier&&) = delete;
+
+        ~Notifier() {
+            if (owner_) {
+                owner_->NotifyWaiters();
+            }
+        }
+
+    private:
+        const Synchronized* owner_;
+    };
+
 public:
     explicit Synchronized(T initial = T())
     : value(move(initial))
     {
     }
 
+    // A const access shares the lock with other const accesses, so readers
+    // such as loggers do not queue up behind each other
     template <typename U>
     struct Access {
         U& ref_to_value;
-        lock_guard<mutex> guard;
+        // Declared before guard so that waiters are woken up after unlocking
+        Notifier notifier;
+        conditional_t<is_const_v<U>, shared_lock<shared_mutex>, unique_lock<shared_mutex>> guard;
     };
 
     Access<T> GetAccess() {
-  	    return {value, lock_guard(m)};
+        return {value, Notifier(this), unique_lock(m)};
     }
 
     Access<const T> GetAccess() const {
-  	    return {value, lock_guard(m)};
+        return {value, Notifier(nullptr), shared_lock(m)};
     }
 
+    // Calls fn(value) under a single lock and returns its result. Lets a
+    // producer push a whole batch of items instead of locking for each one
+    template <typename Function>
+    auto WithLock(Function fn) {
+        auto access = GetAccess();
+        return fn(access.ref_to_value);
+    }
+
+    template <typename Function>
+    auto WithLock(Function fn) const {
+        auto access = GetAccess();
+        return fn(access.ref_to_value);
+    }
+
+    // Blocks until predicate(value) holds and returns a write access to the
+    // value. Every write access wakes up the waiting threads when it ends
+    template <typename Predicate>
+    Access<T> Wait(Predicate predicate) {
+        unique_lock lock(m);
+        if (!predicate(as_const(value))) {
+            ++waiters;
+            cv.wait(lock, [this, &predicate] { return predicate(as_const(value)); });
+            --waiters;
+        }
+        return {value, Notifier(this), move(lock)};
+    }
 
 private:
   T value;
-  mutable mutex m;
+  mutable shared_mutex m;
+  mutable condition_variable_any cv;
+  // Changes only under an exclusive lock, so a writer that unlocks after
+  // a thread started waiting sees it. Without waiters nothing is notified
+  atomic<size_t> waiters = 0;
+
+  void NotifyWaiters() const {
+    if (waiters.load() > 0) {
+      cv.notify_all();
+    }
+  }
+};
+
+const size_t CACHE_LINE_SIZE = 64;
+
+// Bounded multi-producer multi-consumer queue on a ring buffer, after Dmitry Vyukov.
+// Every cell has a sequence number telling whose turn it is: the cell of position pos
+// is free for the producer of pos when sequence == pos and holds the item for the
+// consumer of pos when sequence == pos + 1. Producers and consumers claim positions
+// with a CAS on their own counter, and the two counters live on separate cache lines.
+// Bulk operations claim a run of ready cells with a single CAS.
+// Blocking operations spin with yield, so they suit short waits only
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t min_capacity)
+  : capacity_(ComputeCapacity(min_capacity))
+  , cells_(new Cell[capacity_])
+  {
+    for (size_t i = 0; i < capacity_; ++i) {
+      cells_[i].sequence.store(i, memory_order_relaxed);
+    }
+  }
+
+  size_t GetCapacity() const {
+    return capacity_;
+  }
+
+  // item is moved from only if it has been pushed
+  template <typename U>
+  bool TryPush(U&& item) {
+    size_t pos;
+    if (!ClaimPositions(push_pos_, 0, 1, pos)) {
+      return false;
+    }
+    Publish(pos, forward<U>(item));
+    return true;
+  }
+
+  template <typename U>
+  void Push(U&& item) {
+    while (!TryPush(forward<U>(item))) {
+      this_thread::yield();
+    }
+  }
+
+  optional<T> TryPop() {
+    size_t pos;
+    if (!ClaimPositions(pop_pos_, 1, 1, pos)) {
+      return nullopt;
+    }
+    return Take(pos);
+  }
+
+  T Pop() {
+    while (true) {
+      if (optional<T> item = TryPop()) {
+        return move(*item);
+      }
+      this_thread::yield();
+    }
+  }
+
+  // Pushes the longest prefix of [first, last) that fits and returns the end of it
+  template <typename It>
+  It TryPushBulk(It first, It last) {
+    size_t pos;
+    const size_t count = ClaimPositions(
+      push_pos_, 0, min<size_t>(distance(first, last), capacity_), pos
+    );
+    for (size_t i = 0; i < count; ++i, ++first) {
+      Publish(pos + i, *first);
+    }
+    return first;
+  }
+
+  template <typename It>
+  void PushBulk(It first, It last) {
+    while (first != last) {
+      const It pushed_end = TryPushBulk(first, last);
+      if (pushed_end == first) {
+        this_thread::yield();
+      }
+      first = pushed_end;
+    }
+  }
+
+  // Writes up to max_count items to out and returns how many were popped
+  template <typename OutputIt>
+  size_t TryPopBulk(OutputIt out, size_t max_count) {
+    size_t pos;
+    const size_t count = ClaimPositions(pop_pos_, 1, min(max_count, capacity_), pos);
+    for (size_t i = 0; i < count; ++i) {
+      *out++ = Take(pos + i);
+    }
+    return count;
+  }
+
+  // Waits for at least one item when max_count > 0
+  template <typename OutputIt>
+  size_t PopBulk(OutputIt out, size_t max_count) {
+    while (true) {
+      if (const size_t count = TryPopBulk(out, max_count); count > 0 || max_count == 0) {
+        return count;
+      }
+      this_thread::yield();
+    }
+  }
+
+private:
+  struct Cell {
+    atomic<size_t> sequence;
+    T value;
+  };
+
+  const size_t capacity_;
+  unique_ptr<Cell[]> cells_;
+  alignas(CACHE_LINE_SIZE) atomic<size_t> push_pos_ = 0;
+  alignas(CACHE_LINE_SIZE) atomic<size_t> pop_pos_ = 0;
+
+  static size_t ComputeCapacity(size_t min_capacity) {
+    size_t capacity = 2;
+    while (capacity < min_capacity) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  Cell& GetCell(size_t pos) {
+    return cells_[pos & (capacity_ - 1)];
+  }
+
+  // Claims up to max_count positions starting from counter whose cells are ready, that
+  // is have sequence == pos + lag. Returns how many were claimed, the first one in first
+  size_t ClaimPositions(atomic<size_t>& counter, size_t lag, size_t max_count, size_t& first) {
+    size_t pos = counter.load(memory_order_relaxed);
+    while (max_count > 0) {
+      size_t count = 0;
+      ptrdiff_t diff = 0;
+      for (; count < max_count; ++count) {
+        const size_t sequence = GetCell(pos + count).sequence.load(memory_order_acquire);
+        diff = static_cast<ptrdiff_t>(sequence - (pos + count + lag));
+        if (diff != 0) {
+          break;
+        }
+      }
+      if (count > 0) {
+        if (counter.compare_exchange_weak(pos, pos + count, memory_order_relaxed)) {
+          first = pos;
+          return count;
+        }
+      } else if (diff < 0) {
+        // The cell still holds an item of the previous lap when pushing
+        // or has not got one yet when popping
+        return 0;
+      } else {
+        // Someone else has claimed pos already
+        pos = counter.load(memory_order_relaxed);
+      }
+    }
+    return 0;
+  }
+
+  template <typename U>
+  void Publish(size_t pos, U&& item) {
+    Cell& cell = GetCell(pos);
+    cell.value = forward<U>(item);
+    cell.sequence.store(pos + 1, memory_order_release);
+  }
+
+  T Take(size_t pos) {
+    Cell& cell = GetCell(pos);
+    T item = move(cell.value);
+    cell.sequence.store(pos + capacity_, memory_order_release);
+    return item;
+  }
 };
 
 void TestConcurrentUpdate() {
@@ -72,7 +318,9 @@ vector<int> Consume(Synchronized<deque<int>>& common_queue) {
       //
       // Размер критической секции существенно влияет на быстродействие
       // многопоточных программ.
-      auto access = common_queue.GetAccess();
+      auto access = common_queue.Wait([](const deque<int>& queue) {
+        return !queue.empty();
+      });
       q = move(access.ref_to_value);
     }
 
@@ -92,6 +340,28 @@ void Log(const Synchronized<deque<int>>& common_queue, ostream& out) {
   }
 }
 
+// Consume before Wait appeared: spins on the lock while the queue is empty
+vector<int> ConsumePolling(Synchronized<deque<int>>& common_queue) {
+  vector<int> got;
+
+  for (;;) {
+    deque<int> q;
+
+    {
+      auto access = common_queue.GetAccess();
+      q = move(access.ref_to_value);
+    }
+
+    for (int item : q) {
+      if (item > 0) {
+        got.push_back(item);
+      } else {
+        return got;
+      }
+    }
+  }
+}
+
 void TestProducerConsumer() {
   Synchronized<deque<int>> common_queue;
   ostringstream log;
@@ -114,8 +384,330 @@ void TestProducerConsumer() {
   ASSERT(!logs.empty());
 }
 
+void TestSharedReaders() {
+  const Synchronized<int> common_value(42);
+
+  auto first = common_value.GetAccess();
+  // A writer would block here until first is released
+  auto second = async(launch::async, [&common_value] {
+    return common_value.WithLock([](const int& value) { return value; });
+  });
+  ASSERT(second.wait_for(chrono::seconds(10)) == future_status::ready);
+  ASSERT_EQUAL(second.get(), first.ref_to_value);
+}
+
+void TestWithLock() {
+  Synchronized<vector<int>> common_vector;
+
+  const size_t batch_count = 1000;
+  const size_t batch_size = 100;
+  auto producer = [&common_vector] {
+    for (size_t i = 0; i < batch_count; ++i) {
+      common_vector.WithLock([](vector<int>& items) {
+        for (size_t j = 0; j < batch_size; ++j) {
+          items.push_back(j);
+        }
+      });
+    }
+  };
+
+  auto f1 = async(producer);
+  auto f2 = async(producer);
+  f1.get();
+  f2.get();
+
+  const vector<int>& items = common_vector.GetAccess().ref_to_value;
+  ASSERT_EQUAL(items.size(), 2 * batch_count * batch_size);
+  // Batches are never interleaved
+  for (size_t i = 0; i < items.size(); ++i) {
+    ASSERT_EQUAL(items[i], static_cast<int>(i % batch_size));
+  }
+  ASSERT_EQUAL(as_const(common_vector).WithLock(
+    [](const vector<int>& items) { return items.size(); }
+  ), items.size());
+}
+
+void TestWait() {
+  Synchronized<int> common_value;
+
+  auto waiter = async(launch::async, [&common_value] {
+    auto access = common_value.Wait([](int value) { return value >= 3; });
+    return access.ref_to_value;
+  });
+  for (int i = 0; i < 3; ++i) {
+    ASSERT(waiter.wait_for(chrono::milliseconds(10)) == future_status::timeout);
+    ++common_value.GetAccess().ref_to_value;
+  }
+  ASSERT_EQUAL(waiter.get(), 3);
+
+  // A predicate that already holds does not block
+  ASSERT_EQUAL(common_value.Wait([](int value) { return value == 3; }).ref_to_value, 3);
+}
+
+void TestBoundedQueue() {
+  BoundedQueue<string> queue(3);
+  ASSERT_EQUAL(queue.GetCapacity(), 4u);
+  ASSERT(!queue.TryPop());
+
+  // Several laps around the ring
+  for (int lap = 0; lap < 3; ++lap) {
+    for (int i = 0; i < 4; ++i) {
+      ASSERT(queue.TryPush(to_string(lap * 4 + i)));
+    }
+    string extra = "extra";
+    ASSERT(!queue.TryPush(move(extra)));
+    ASSERT_EQUAL(extra, "extra");
+    for (int i = 0; i < 4; ++i) {
+      ASSERT_EQUAL(queue.Pop(), to_string(lap * 4 + i));
+    }
+    ASSERT(!queue.TryPop());
+  }
+}
+
+void TestBoundedQueueBulk() {
+  BoundedQueue<int> queue(8);
+  vector<int> items(10);
+  iota(begin(items), end(items), 0);
+
+  ASSERT(queue.TryPushBulk(begin(items), end(items)) == begin(items) + 8);
+  vector<int> got;
+  ASSERT_EQUAL(queue.TryPopBulk(back_inserter(got), 5), 5u);
+  ASSERT(queue.TryPushBulk(begin(items) + 8, end(items)) == end(items));
+  ASSERT_EQUAL(queue.TryPopBulk(back_inserter(got), 100), 5u);
+  ASSERT_EQUAL(queue.TryPopBulk(back_inserter(got), 100), 0u);
+  ASSERT_EQUAL(got, items);
+}
+
+template <typename Consumer>
+vector<int> RunProducerConsumer(Consumer consume, size_t item_count, size_t batch_size) {
+  Synchronized<deque<int>> common_queue;
+  ostringstream log;
+
+  auto consumer = async(launch::async, consume, ref(common_queue));
+  auto logger = async(launch::async, Log, cref(common_queue), ref(log));
+
+  for (size_t first = 1; first <= item_count; first += batch_size) {
+    const size_t last = min(first + batch_size, item_count + 1);
+    if (batch_size == 1) {
+      common_queue.GetAccess().ref_to_value.push_back(first);
+    } else {
+      common_queue.WithLock([first, last](deque<int>& q) {
+        for (size_t i = first; i < last; ++i) {
+          q.push_back(i);
+        }
+      });
+    }
+  }
+  common_queue.GetAccess().ref_to_value.push_back(-1);
+
+  logger.get();
+  return consumer.get();
+}
+
+void BenchmarkProducerConsumer() {
+  const size_t item_count = 2'000'000;
+  vector<int> expected(item_count);
+  iota(begin(expected), end(expected), 1);
+
+  {
+    LOG_DURATION("polling consumer, lock per item");
+    ASSERT_EQUAL(RunProducerConsumer(ConsumePolling, item_count, 1), expected);
+  }
+  {
+    LOG_DURATION("waiting consumer, lock per item");
+    ASSERT_EQUAL(RunProducerConsumer(Consume, item_count, 1), expected);
+  }
+  for (size_t batch_size : {10, 100, 1000}) {
+    LOG_DURATION("waiting consumer, batches of " + to_string(batch_size));
+    ASSERT_EQUAL(RunProducerConsumer(Consume, item_count, batch_size), expected);
+  }
+}
+
+template <typename T, typename It>
+void PushItems(Synchronized<deque<T>>& channel, It first, It last) {
+  channel.WithLock([first, last](deque<T>& q) {
+    q.insert(end(q), first, last);
+  });
+}
+
+template <typename T, typename It>
+void PushItems(BoundedQueue<T>& channel, It first, It last) {
+  channel.PushBulk(first, last);
+}
+
+// Waits for at least one item and moves up to max_count items to the end of items
+template <typename T>
+void PopItems(Synchronized<deque<T>>& channel, vector<T>& items, size_t max_count) {
+  auto access = channel.Wait([](const deque<T>& q) {
+    return !q.empty();
+  });
+  deque<T>& q = access.ref_to_value;
+  const auto taken_end = begin(q) + min(max_count, q.size());
+  move(begin(q), taken_end, back_inserter(items));
+  q.erase(begin(q), taken_end);
+}
+
+template <typename T>
+void PopItems(BoundedQueue<T>& channel, vector<T>& items, size_t max_count) {
+  channel.PopBulk(back_inserter(items), max_count);
+}
+
+// Producers hand items 1..item_count over in batches to consumers, which stop at
+// the item 0. Returns everything consumed, sorted
+template <typename Channel>
+vector<int> RunHandOff(
+    Channel& channel, size_t producer_count, size_t consumer_count,
+    size_t item_count, size_t batch_size
+) {
+  auto producer = [&channel, batch_size](size_t first_item, size_t last_item) {
+    vector<int> batch;
+    for (size_t item = first_item; item < last_item; ) {
+      batch.clear();
+      for (; item < last_item && batch.size() < batch_size; ++item) {
+        batch.push_back(item);
+      }
+      PushItems(channel, begin(batch), end(batch));
+    }
+  };
+  auto consumer = [&channel, batch_size] {
+    vector<int> got;
+    vector<int> batch;
+    while (true) {
+      batch.clear();
+      PopItems(channel, batch, batch_size);
+      const auto stop = find(begin(batch), end(batch), 0);
+      got.insert(end(got), begin(batch), stop);
+      if (stop != end(batch)) {
+        // Stops come last, the other ones are left to the other consumers
+        PushItems(channel, next(stop), end(batch));
+        return got;
+      }
+    }
+  };
+
+  vector<future<vector<int>>> consumers;
+  for (size_t i = 0; i < consumer_count; ++i) {
+    consumers.push_back(async(launch::async, consumer));
+  }
+  vector<future<void>> producers;
+  for (size_t i = 0; i < producer_count; ++i) {
+    producers.push_back(async(
+      launch::async, producer,
+      1 + item_count * i / producer_count, 1 + item_count * (i + 1) / producer_count
+    ));
+  }
+  for (auto& f : producers) {
+    f.get();
+  }
+  const vector<int> stops(consumer_count, 0);
+  PushItems(channel, begin(stops), end(stops));
+
+  vector<int> result;
+  for (auto& f : consumers) {
+    const vector<int> got = f.get();
+    result.insert(end(result), begin(got), end(got));
+  }
+  sort(begin(result), end(result));
+  return result;
+}
+
+void TestHandOff() {
+  const size_t item_count = 100000;
+  vector<int> expected(item_count);
+  iota(begin(expected), end(expected), 1);
+
+  for (size_t batch_size : {1, 7}) {
+    {
+      BoundedQueue<int> queue(8);
+      ASSERT_EQUAL(RunHandOff(queue, 4, 4, item_count, batch_size), expected);
+    }
+    {
+      Synchronized<deque<int>> common_queue;
+      ASSERT_EQUAL(RunHandOff(common_queue, 4, 4, item_count, batch_size), expected);
+    }
+  }
+}
+
+// Times how long items wait in the channel when a producer pushes them one by one
+// as fast as it can
+template <typename Channel>
+void MeasureLatency(const string& name, Channel& channel, size_t item_count) {
+  using Clock = chrono::steady_clock;
+
+  auto consumer = [&channel] {
+    vector<int64_t> latencies;
+    vector<int64_t> items;
+    while (true) {
+      items.clear();
+      PopItems(channel, items, 1);
+      if (items.front() == 0) {
+        return latencies;
+      }
+      latencies.push_back(Clock::now().time_since_epoch().count() - items.front());
+    }
+  };
+
+  auto latencies_future = async(launch::async, consumer);
+  for (size_t i = 0; i < item_count; ++i) {
+    const int64_t stamp = Clock::now().time_since_epoch().count();
+    PushItems(channel, &stamp, &stamp + 1);
+  }
+  const int64_t stop = 0;
+  PushItems(channel, &stop, &stop + 1);
+
+  vector<int64_t> latencies = latencies_future.get();
+  sort(begin(latencies), end(latencies));
+  auto to_us = [](int64_t ticks) {
+    return chrono::duration_cast<chrono::microseconds>(Clock::duration(ticks)).count();
+  };
+  cerr << name << " latency: median " << to_us(latencies[latencies.size() / 2])
+       << " us, p99 " << to_us(latencies[latencies.size() * 99 / 100]) << " us" << endl;
+}
+
+void BenchmarkHandOff() {
+  const size_t item_count = 2'000'000;
+  const size_t queue_capacity = 1024;
+  vector<int> expected(item_count);
+  iota(begin(expected), end(expected), 1);
+
+  for (auto [producer_count, consumer_count] : {pair{1, 1}, pair{4, 4}}) {
+    for (size_t batch_size : {1, 100}) {
+      const string suffix = ", " + to_string(producer_count) + "x" + to_string(consumer_count)
+        + " threads, batches of " + to_string(batch_size);
+      {
+        Synchronized<deque<int>> common_queue;
+        LOG_DURATION("Synchronized<deque>" + suffix);
+        ASSERT_EQUAL(RunHandOff(common_queue, producer_count, consumer_count, item_count, batch_size), expected);
+      }
+      {
+        BoundedQueue<int> queue(queue_capacity);
+        LOG_DURATION("BoundedQueue" + suffix);
+        ASSERT_EQUAL(RunHandOff(queue, producer_count, consumer_count, item_count, batch_size), expected);
+      }
+    }
+  }
+
+  const size_t latency_item_count = 200'000;
+  {
+    Synchronized<deque<int64_t>> common_queue;
+    MeasureLatency("Synchronized<deque>", common_queue, latency_item_count);
+  }
+  {
+    BoundedQueue<int64_t> queue(queue_capacity);
+    MeasureLatency("BoundedQueue", queue, latency_item_count);
+  }
+}
+
 int main() {
   TestRunner tr;
   RUN_TEST(tr, TestConcurrentUpdate);
   RUN_TEST(tr, TestProducerConsumer);
+  RUN_TEST(tr, TestSharedReaders);
+  RUN_TEST(tr, TestWithLock);
+  RUN_TEST(tr, TestWait);
+  RUN_TEST(tr, TestBoundedQueue);
+  RUN_TEST(tr, TestBoundedQueueBulk);
+  RUN_TEST(tr, TestHandOff);
+  RUN_TEST(tr, BenchmarkProducerConsumer);
+  RUN_TEST(tr, BenchmarkHandOff);
 }
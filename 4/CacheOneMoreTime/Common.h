@@ -28,11 +28,26 @@ public:
 // Интерфейс, представляющий кэш
 class ICache {
 public:
+  // Какие книги вытесняются, когда кэш заполнен
+  enum class Policy {
+    // Те, к которым дольше всего не обращались
+    LRU,
+    // Новая книга попадает в кэш, только если её спрашивают чаще, чем ту,
+    // которую пришлось бы ради неё вытеснить. Разовые проходы по всему
+    // каталогу не вымывают из кэша популярные книги
+    W_TINY_LFU
+  };
+
   // Настройки кэша
   struct Settings {
     // Максимальный допустимый объём памяти, потребляемый закэшированными
     // объектами, в байтах
     size_t max_memory = 0;
+    // Число независимых сегментов кэша, каждый со своим мьютексом и своей
+    // долей max_memory. Больше сегментов — меньше потоков ждут друг друга,
+    // но книги больше max_memory / shard_count не кэшируются вовсе
+    size_t shard_count = 1;
+    Policy policy = Policy::LRU;
   };
 
   using BookPtr = std::shared_ptr<const IBook>;
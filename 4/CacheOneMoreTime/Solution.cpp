@@ -1,61 +1,394 @@
 #include "Common.h"
 
-#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <iterator>
 #include <list>
+#include <memory>
 #include <mutex>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
 using namespace std;
 
-class LruCache : public ICache {
-  shared_ptr<IBooksUnpacker> books_unpacker_;
+using BookPtr = ICache::BookPtr;
+
+// Книги одного сегмента кэша. Решает, какие книги хранить, а какие
+// вытеснять, и не вылезает за свою долю max_memory
+class BookStorage {
+public:
+  virtual ~BookStorage() = default;
+
+  // Отмечает обращение к книге. Если книги нет, возвращает nullptr
+  virtual BookPtr Find(string_view book_name) = 0;
+  // Предлагает только что распакованную книгу
+  virtual void Add(const BookPtr& book) = 0;
+};
+
+
+// Список книг от давно использованных к недавно использованным с суммарным
+// объёмом книг. Вынимать и вставлять книги можно по итератору из индекса
+class BookList {
+public:
+  using Iterator = list<BookPtr>::iterator;
+
+  bool IsEmpty() const {
+    return books_.empty();
+  }
+
+  size_t GetMemoryUsage() const {
+    return memory_usage_;
+  }
+
+  const BookPtr& Oldest() const {
+    return books_.front();
+  }
+
+  // Обход от давно использованных книг к недавно использованным
+  list<BookPtr>::const_iterator begin() const {
+    return books_.begin();
+  }
+
+  list<BookPtr>::const_iterator end() const {
+    return books_.end();
+  }
+
+  Iterator PushBack(BookPtr book) {
+    memory_usage_ += book->GetContent().size();
+    books_.push_back(move(book));
+    return prev(books_.end());
+  }
+
+  // Переносит книгу в конец этого списка из любого другого, итератор остаётся
+  // действительным
+  void MoveToBack(BookList& from, Iterator it) {
+    const size_t book_size = (*it)->GetContent().size();
+    from.memory_usage_ -= book_size;
+    memory_usage_ += book_size;
+    books_.splice(books_.end(), from.books_, it);
+  }
+
+  void PopFront() {
+    memory_usage_ -= books_.front()->GetContent().size();
+    books_.pop_front();
+  }
+
+private:
   list<BookPtr> books_;
-  unordered_map<string, list<BookPtr>::iterator> cache_;
-  size_t max_memory_;
   size_t memory_usage_ = 0;
-  mutable mutex m;
+};
+
+
+// Вытесняет книги, к которым дольше всего не обращались. Попадание стоит O(1):
+// поиск в хеш-таблице и перенос элемента в конец списка
+class LruStorage : public BookStorage {
+public:
+  explicit LruStorage(size_t max_memory) : max_memory_(max_memory) {}
+
+  BookPtr Find(string_view book_name) override {
+    const auto it = index_.find(book_name);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    books_.MoveToBack(books_, it->second);
+    return *it->second;
+  }
+
+  void Add(const BookPtr& book) override {
+    const size_t book_size = book->GetContent().size();
+    if (book_size > max_memory_) {
+      return;
+    }
+    while (books_.GetMemoryUsage() + book_size > max_memory_) {
+      index_.erase(books_.Oldest()->GetName());
+      books_.PopFront();
+    }
+    index_.emplace(book->GetName(), books_.PushBack(book));
+  }
+
+private:
+  size_t max_memory_;
+  BookList books_;
+  // Ключи ссылаются на названия книг из books_
+  unordered_map<string_view, BookList::Iterator> index_;
+};
+
+
+// Приблизительные частоты обращений к книгам: count-min sketch из четырёх
+// строк четырёхбитных счётчиков. Оценка не меньше настоящей частоты
+// и ошибается тем реже, чем шире строки. Когда счётчики набрали десять
+// обращений на ячейку строки, все они уменьшаются вдвое, так что давняя
+// популярность постепенно забывается
+class FrequencySketch {
+public:
+  explicit FrequencySketch(size_t width) {
+    width_ = 16;
+    while (width_ < width) {
+      width_ *= 2;
+    }
+    counters_.assign(DEPTH * width_, 0);
+    sample_size_ = 10 * width_;
+  }
+
+  void Add(size_t hash) {
+    // Увеличиваются только минимальные счётчики: остальные и так
+    // переоценивают частоту из-за коллизий
+    const int count = Estimate(hash);
+    if (count == MAX_COUNT) {
+      return;
+    }
+    for (int row = 0; row < DEPTH; ++row) {
+      uint8_t& counter = counters_[Index(hash, row)];
+      if (counter == count) {
+        ++counter;
+      }
+    }
+    if (++additions_ == sample_size_) {
+      for (uint8_t& counter : counters_) {
+        counter /= 2;
+      }
+      additions_ /= 2;
+    }
+  }
+
+  int Estimate(size_t hash) const {
+    int count = MAX_COUNT;
+    for (int row = 0; row < DEPTH; ++row) {
+      count = min<int>(count, counters_[Index(hash, row)]);
+    }
+    return count;
+  }
+
+private:
+  static const int DEPTH = 4;
+  static const int MAX_COUNT = 15;
+
+  size_t width_;
+  vector<uint8_t> counters_;
+  size_t sample_size_;
+  size_t additions_ = 0;
+
+  size_t Index(size_t hash, int row) const {
+    // У каждой строки свой множитель, иначе книги, столкнувшиеся в одной
+    // строке, сталкивались бы и во всех остальных
+    static const uint64_t SEEDS[DEPTH] = {
+      0xC3A5C85C97CB3127ull, 0xB492B66FBE98F273ull,
+      0x9AE16A3B2F90404Full, 0xCBF29CE484222325ull
+    };
+    uint64_t mixed = (hash + SEEDS[row]) * SEEDS[row];
+    mixed += mixed >> 32;
+    return row * width_ + (mixed & (width_ - 1));
+  }
+};
+
+
+// W-TinyLFU. Новые книги сначала попадают в маленькое LRU-окно (1% объёма).
+// Книга, вытесненная из окна, допускается в основную часть, только если по
+// оценке FrequencySketch её спрашивают чаще, чем книгу, которую пришлось бы
+// ради неё вытеснить. Основная часть — сегментированный LRU: книги из неё,
+// к которым обратились повторно, переходят из испытательного списка
+// в защищённый (80% основной части) и вытесняются в последнюю очередь.
+// Поэтому проход по всему каталогу задевает только окно, а популярные книги
+// остаются в кэше
+class TinyLfuStorage : public BookStorage {
+public:
+  explicit TinyLfuStorage(size_t max_memory)
+    : window_max_memory_(max_memory / 100)
+    , main_max_memory_(max_memory - window_max_memory_)
+    , protected_max_memory_(main_max_memory_ / 10 * 8)
+    // Строка примерно по ячейке на каждые 16 байт объёма: счётчиков должно
+    // хватать не только на книги в кэше, но и на кандидатов в него
+    , sketch_(clamp<size_t>(max_memory / 16, 256, 1 << 20))
+  {}
+
+  BookPtr Find(string_view book_name) override {
+    // Промахи тоже считаются: именно по ним видно, что книгу стоит хранить
+    sketch_.Add(hash<string_view>{}(book_name));
+    const auto it = index_.find(book_name);
+    if (it == index_.end()) {
+      return nullptr;
+    }
+    Entry& entry = it->second;
+    switch (entry.segment) {
+      case Segment::WINDOW:
+        window_.MoveToBack(window_, entry.it);
+        break;
+      case Segment::PROBATION:
+        protected_.MoveToBack(probation_, entry.it);
+        entry.segment = Segment::PROTECTED;
+        while (protected_.GetMemoryUsage() > protected_max_memory_) {
+          Demote();
+        }
+        break;
+      case Segment::PROTECTED:
+        protected_.MoveToBack(protected_, entry.it);
+        break;
+    }
+    return *entry.it;
+  }
+
+  void Add(const BookPtr& book) override {
+    if (book->GetContent().size() > window_max_memory_ + main_max_memory_) {
+      return;
+    }
+    index_.emplace(book->GetName(), Entry{window_.PushBack(book), Segment::WINDOW});
+    while (window_.GetMemoryUsage() > window_max_memory_) {
+      AdmitOldestFromWindow();
+    }
+  }
+
+private:
+  enum class Segment {
+    WINDOW,
+    PROBATION,
+    PROTECTED
+  };
+
+  struct Entry {
+    BookList::Iterator it;
+    Segment segment;
+  };
+
+  size_t window_max_memory_;
+  size_t main_max_memory_;
+  size_t protected_max_memory_;
+  BookList window_;
+  BookList probation_;
+  BookList protected_;
+  // Ключи ссылаются на названия книг из списков
+  unordered_map<string_view, Entry> index_;
+  FrequencySketch sketch_;
+
+  size_t GetMainMemoryUsage() const {
+    return probation_.GetMemoryUsage() + protected_.GetMemoryUsage();
+  }
+
+  int EstimateFrequency(const BookPtr& book) const {
+    return sketch_.Estimate(hash<string_view>{}(book->GetName()));
+  }
+
+  void Demote() {
+    Entry& entry = index_.at(protected_.Oldest()->GetName());
+    probation_.MoveToBack(protected_, entry.it);
+    entry.segment = Segment::PROBATION;
+  }
+
+  void Evict(BookList& books) {
+    index_.erase(books.Oldest()->GetName());
+    books.PopFront();
+  }
+
+  void AdmitOldestFromWindow() {
+    const BookPtr& candidate = window_.Oldest();
+    const size_t candidate_size = candidate->GetContent().size();
+    if (candidate_size > main_max_memory_) {
+      Evict(window_);
+      return;
+    }
+    // Жертвы сначала только подбираются: давние книги испытательного списка,
+    // затем защищённого, пока не освободится место. Вытесняются они все сразу
+    // и только если кандидат популярнее каждой из них, иначе не вытесняется
+    // ни одна
+    const int candidate_frequency = EstimateFrequency(candidate);
+    size_t memory_usage = GetMainMemoryUsage();
+    BookList* const victim_lists[] = {&probation_, &protected_};
+    size_t victim_counts[] = {0, 0};
+    for (size_t i = 0; i < size(victim_lists); ++i) {
+      for (const BookPtr& victim : *victim_lists[i]) {
+        if (memory_usage + candidate_size <= main_max_memory_) {
+          break;
+        }
+        if (EstimateFrequency(victim) >= candidate_frequency) {
+          Evict(window_);
+          return;
+        }
+        memory_usage -= victim->GetContent().size();
+        ++victim_counts[i];
+      }
+    }
+    for (size_t i = 0; i < size(victim_lists); ++i) {
+      for (size_t j = 0; j < victim_counts[i]; ++j) {
+        Evict(*victim_lists[i]);
+      }
+    }
+    Entry& entry = index_.at(candidate->GetName());
+    probation_.MoveToBack(window_, entry.it);
+    entry.segment = Segment::PROBATION;
+  }
+};
+
+
+unique_ptr<BookStorage> MakeBookStorage(ICache::Policy policy, size_t max_memory) {
+  switch (policy) {
+    case ICache::Policy::W_TINY_LFU:
+      return make_unique<TinyLfuStorage>(max_memory);
+    case ICache::Policy::LRU:
+      break;
+  }
+  return make_unique<LruStorage>(max_memory);
+}
+
+
+// Кэш разбит на сегменты по хешу названия книги. У каждого сегмента свой
+// мьютекс, своё хранилище книг и своя доля max_memory, так что потоки,
+// читающие разные книги, почти не мешают друг другу.
+// Если несколько потоков одновременно промахиваются по одной книге, то
+// распаковывает её только первый, остальные ждут его результата.
+class ShardedCache : public ICache {
+  struct Shard {
+    mutex m;
+    unique_ptr<BookStorage> books;
+    // Книги, которые сейчас распаковываются
+    unordered_map<string, shared_future<BookPtr>> unpacking;
+  };
+
+  shared_ptr<IBooksUnpacker> books_unpacker_;
+  vector<Shard> shards_;
 
 public:
-  LruCache(
+  ShardedCache(
       shared_ptr<IBooksUnpacker> books_unpacker,
       const Settings& settings
-  ) : books_unpacker_(move(books_unpacker)), max_memory_(settings.max_memory)
+  ) : books_unpacker_(move(books_unpacker)), shards_(max<size_t>(settings.shard_count, 1))
   {
-    // реализуйте метод
+    for (Shard& shard : shards_) {
+      shard.books = MakeBookStorage(settings.policy, settings.max_memory / shards_.size());
+    }
   }
 
   BookPtr GetBook(const string& book_name) override {
-    // реализуйте метод
-    unique_lock<mutex> lock(m);
-    auto it = cache_.find(book_name);
-    if (it != cache_.end()) {
-      // если книга есть в кэше
-      books_.splice(books_.end(), books_, it->second);
-      it->second = prev(books_.end());
-      return *it->second;
-    } else {
-      // если книги нет в кэше
-      lock.unlock(); // КОНКУРЕНТНАЯ ОБЛАСТЬ
-      BookPtr book = books_unpacker_->UnpackBook(book_name);
-      if (book->GetContent().size() > max_memory_)
-        return book;
-      lock.lock(); // КОНЕЦ КОНКУРЕНТНОЙ ОБЛАСТИ
-      memory_usage_ += book->GetContent().size();
-      if (memory_usage_ > max_memory_)
-        FreeCache();
-      books_.push_back(move(book));
-      cache_[book_name] = prev(books_.end());
-      return books_.back();
-    }
-  }
-
-protected:
-  void FreeCache() {
-    while (!books_.empty() && memory_usage_ > max_memory_) {
-      cache_.erase(books_.front()->GetName());
-      memory_usage_ -= books_.front()->GetContent().size();
-      books_.pop_front();
+    Shard& shard = shards_[hash<string>{}(book_name) % shards_.size()];
+    unique_lock<mutex> lock(shard.m);
+    if (BookPtr book = shard.books->Find(book_name)) {
+      return book;
+    }
+    if (auto it = shard.unpacking.find(book_name); it != shard.unpacking.end()) {
+      shared_future<BookPtr> book = it->second;
+      lock.unlock();
+      return book.get();
+    }
+
+    promise<BookPtr> book_promise;
+    shard.unpacking.emplace(book_name, book_promise.get_future().share());
+    lock.unlock(); // КОНКУРЕНТНАЯ ОБЛАСТЬ
+    BookPtr book;
+    try {
+      book = books_unpacker_->UnpackBook(book_name);
+    } catch (...) {
+      lock.lock();
+      shard.unpacking.erase(book_name);
+      book_promise.set_exception(current_exception());
+      throw;
     }
+    lock.lock(); // КОНЕЦ КОНКУРЕНТНОЙ ОБЛАСТИ
+    shard.unpacking.erase(book_name);
+    shard.books->Add(book);
+    lock.unlock();
+    book_promise.set_value(book);
+    return book;
   }
 };
 
@@ -64,6 +397,5 @@ unique_ptr<ICache> MakeCache(
     shared_ptr<IBooksUnpacker> books_unpacker,
     const ICache::Settings& settings
 ) {
-  // реализуйте функцию
-  return make_unique<LruCache>(move(books_unpacker), settings);
+  return make_unique<ShardedCache>(move(books_unpacker), settings);
 }
@@ -1,11 +1,14 @@
 #include "Common.h"
 #include "../../test_runner.h"
+#include "../../profile.h"
 
 #include <atomic>
+#include <algorithm>
 #include <future>
 #include <numeric>
 #include <random>
 #include <sstream>
+#include <thread>
 
 using namespace std;
 
@@ -182,6 +185,275 @@ void TestAsync(const Library& lib) {
 }
 
 
+// Распаковывает долго, чтобы одновременные промахи по одной книге успели
+// встретиться
+class SlowBooksUnpacker : public BooksUnpacker {
+public:
+  unique_ptr<IBook> UnpackBook(const string& book_name) override {
+    this_thread::sleep_for(chrono::milliseconds(50));
+    return BooksUnpacker::UnpackBook(book_name);
+  }
+};
+
+
+void TestUnpackOnce(const Library& lib) {
+  auto unpacker = make_shared<SlowBooksUnpacker>();
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes;
+  settings.shard_count = 4;
+  auto cache = MakeCache(unpacker, settings);
+
+  vector<future<ICache::BookPtr>> tasks;
+  for (int i = 0; i < 8; ++i) {
+    tasks.push_back(async(launch::async, [&cache, &lib] {
+      return cache->GetBook(lib.book_names[0]);
+    }));
+  }
+  const auto book = tasks[0].get();
+  for (size_t i = 1; i < tasks.size(); ++i) {
+    ASSERT_EQUAL(tasks[i].get(), book);
+  }
+  ASSERT_EQUAL(unpacker->GetUnpackedBooksCount(), 1);
+}
+
+
+void TestShardedMaxMemory(const Library& lib) {
+  auto unpacker = make_shared<BooksUnpacker>();
+  ICache::Settings settings;
+  settings.max_memory = lib.size_in_bytes / 2;
+  settings.shard_count = 3;
+  auto cache = MakeCache(unpacker, settings);
+
+  for (int round = 0; round < 3; ++round) {
+    for (const auto& name : lib.book_names) {
+      ASSERT_EQUAL(cache->GetBook(name)->GetName(), name);
+      ASSERT(unpacker->GetMemoryUsedByBooks() <= settings.max_memory);
+    }
+  }
+}
+
+
+void TestTinyLfuBasics(const Library& lib) {
+  ICache::Settings settings;
+  settings.policy = ICache::Policy::W_TINY_LFU;
+  {
+    auto unpacker = make_shared<BooksUnpacker>();
+    settings.max_memory = lib.size_in_bytes;
+    auto cache = MakeCache(unpacker, settings);
+    for (int i = 0; i < 3; ++i) {
+      ASSERT_EQUAL(cache->GetBook(lib.book_names[0])->GetName(), lib.book_names[0]);
+    }
+    ASSERT_EQUAL(unpacker->GetUnpackedBooksCount(), 1);
+  }
+  {
+    auto unpacker = make_shared<BooksUnpacker>();
+    settings.max_memory =
+        unpacker->UnpackBook(lib.book_names[0])->GetContent().size() - 1;
+    auto cache = MakeCache(unpacker, settings);
+    cache->GetBook(lib.book_names[0]);
+    ASSERT_EQUAL(unpacker->GetMemoryUsedByBooks(), size_t(0));
+  }
+  for (size_t shard_count : {1, 3}) {
+    auto unpacker = make_shared<BooksUnpacker>();
+    settings.max_memory = lib.size_in_bytes / 2;
+    settings.shard_count = shard_count;
+    auto cache = MakeCache(unpacker, settings);
+    mt19937 gen(shard_count);
+    uniform_int_distribution<size_t> dis(0, lib.book_names.size() - 1);
+    for (int i = 0; i < 1000; ++i) {
+      const auto& name = lib.book_names[dis(gen)];
+      ASSERT_EQUAL(cache->GetBook(name)->GetName(), name);
+      ASSERT(unpacker->GetMemoryUsedByBooks() <= settings.max_memory);
+    }
+  }
+}
+
+
+// Популярные книги переживают проход по каталогу, который в десять раз
+// больше кэша
+void TestTinyLfuScanResistance(const Library&) {
+  const size_t hot_book_count = 20;
+  vector<string> book_names;
+  for (size_t i = 0; i < 1000; ++i) {
+    book_names.push_back("Book #" + to_string(i));
+  }
+  const size_t book_size = BooksUnpacker().UnpackBook(book_names.back())->GetContent().size();
+
+  for (auto policy : {ICache::Policy::LRU, ICache::Policy::W_TINY_LFU}) {
+    auto unpacker = make_shared<BooksUnpacker>();
+    ICache::Settings settings;
+    settings.max_memory = 100 * book_size;
+    settings.policy = policy;
+    auto cache = MakeCache(unpacker, settings);
+
+    for (int round = 0; round < 10; ++round) {
+      for (size_t i = 0; i < hot_book_count; ++i) {
+        cache->GetBook(book_names[i]);
+      }
+    }
+    for (size_t i = hot_book_count; i < book_names.size(); ++i) {
+      cache->GetBook(book_names[i]);
+      ASSERT(unpacker->GetMemoryUsedByBooks() <= settings.max_memory);
+    }
+    const int unpacked_before = unpacker->GetUnpackedBooksCount();
+    for (size_t i = 0; i < hot_book_count; ++i) {
+      cache->GetBook(book_names[i]);
+    }
+    const int hot_misses = unpacker->GetUnpackedBooksCount() - unpacked_before;
+    ASSERT_EQUAL(hot_misses, policy == ICache::Policy::LRU ? int(hot_book_count) : 0);
+  }
+}
+
+
+// Большой кандидат, которому нужно место и холодной маленькой книги, и горячей
+// книги за ней, не допускается, и холодная книга при этом остаётся в кэше
+void TestTinyLfuAdmitsAllOrNothing(const Library&) {
+  const string hot_book = string(10, 'h');
+  const string cold_book = "c";
+  const string large_book = string(60, 'l');
+
+  auto unpacker = make_shared<BooksUnpacker>();
+  auto get_size = [&unpacker](const string& name) {
+    return unpacker->UnpackBook(name)->GetContent().size();
+  };
+  const size_t hot_size = get_size(hot_book);
+  const size_t cold_size = get_size(cold_book);
+  const size_t large_size = get_size(large_book);
+
+  ICache::Settings settings;
+  settings.policy = ICache::Policy::W_TINY_LFU;
+  // Окно меньше любой книги, поэтому каждая книга сразу претендует на основную
+  // часть. Туда помещаются горячая и холодная книги, но большой книге нужно
+  // место обеих
+  settings.max_memory = 100;
+  const size_t main_max_memory = settings.max_memory - settings.max_memory / 100;
+  ASSERT(settings.max_memory / 100 < cold_size);
+  ASSERT(hot_size + cold_size <= main_max_memory);
+  ASSERT(large_size <= main_max_memory);
+  ASSERT(large_size + hot_size > main_max_memory);
+  auto cache = MakeCache(unpacker, settings);
+
+  for (int i = 0; i < 5; ++i) {
+    cache->GetBook(hot_book);
+  }
+  // Не допускается из-за горячей книги, но становится популярнее холодной
+  cache->GetBook(large_book);
+  cache->GetBook(large_book);
+  cache->GetBook(cold_book);
+
+  cache->GetBook(large_book);
+  const int unpacked_before = unpacker->GetUnpackedBooksCount();
+  cache->GetBook(cold_book);
+  cache->GetBook(hot_book);
+  ASSERT_EQUAL(unpacker->GetUnpackedBooksCount(), unpacked_before);
+}
+
+
+// Доля попаданий для обеих стратегий на двух потоках запросов: книги
+// с распределением Ципфа и то же самое вперемешку с проходами по каталогу
+void BenchmarkHitRatio(const Library&) {
+  const size_t book_count = 20000;
+  const size_t popular_book_count = 10000;
+  const int request_count = 500000;
+  vector<string> book_names;
+  for (size_t i = 0; i < book_count; ++i) {
+    book_names.push_back("Book #" + to_string(i));
+  }
+  const size_t book_size = BooksUnpacker().UnpackBook(book_names.back())->GetContent().size();
+
+  // Популярность падает как 1 / rank, популярные книги разбросаны по первой
+  // половине каталога
+  vector<double> weights(popular_book_count);
+  for (size_t rank = 0; rank < popular_book_count; ++rank) {
+    weights[rank] = 1. / (rank + 1);
+  }
+  vector<size_t> book_by_rank(popular_book_count);
+  iota(book_by_rank.begin(), book_by_rank.end(), 0);
+  mt19937 gen(42);
+  shuffle(book_by_rank.begin(), book_by_rank.end(), gen);
+  discrete_distribution<size_t> zipf(weights.begin(), weights.end());
+
+  vector<size_t> zipf_trace;
+  for (int i = 0; i < request_count; ++i) {
+    zipf_trace.push_back(book_by_rank[zipf(gen)]);
+  }
+  // Каждые 10000 запросов — проход по 2000 книгам второй половины каталога
+  vector<size_t> scan_trace;
+  size_t next_scanned = popular_book_count;
+  for (int i = 0; i < request_count; ++i) {
+    scan_trace.push_back(zipf_trace[i]);
+    if (i % 10000 == 0) {
+      for (int j = 0; j < 2000; ++j) {
+        scan_trace.push_back(next_scanned);
+        next_scanned = next_scanned + 1 < book_count ? next_scanned + 1 : popular_book_count;
+      }
+    }
+  }
+
+  for (const auto& [trace_name, trace] : {pair{"zipf", &zipf_trace}, pair{"zipf + scans", &scan_trace}}) {
+    for (const auto& [policy_name, policy] : {pair{"LRU", ICache::Policy::LRU}, pair{"W-TinyLFU", ICache::Policy::W_TINY_LFU}}) {
+      auto unpacker = make_shared<BooksUnpacker>();
+      ICache::Settings settings;
+      settings.max_memory = book_count / 20 * book_size;
+      settings.policy = policy;
+      auto cache = MakeCache(unpacker, settings);
+      {
+        LOG_DURATION(string(policy_name) + ", " + trace_name);
+        for (size_t book : *trace) {
+          cache->GetBook(book_names[book]);
+        }
+      }
+      const int unpacked = unpacker->GetUnpackedBooksCount();
+      cerr << "  " << unpacked << " unpacks for " << trace->size() << " requests, hit ratio "
+           << 1. - double(unpacked) / trace->size() << endl;
+    }
+  }
+}
+
+
+// Потоки читают книги из каталога, где небольшая часть книг популярна,
+// а кэш вмещает всех популярных
+void BenchmarkThroughput(const Library&) {
+  const size_t book_count = 10000;
+  const size_t hot_book_count = 500;
+  const int requests_per_thread = 200000;
+  vector<string> book_names;
+  for (size_t i = 0; i < book_count; ++i) {
+    book_names.push_back("Book #" + to_string(i));
+  }
+  const size_t book_size = BooksUnpacker().UnpackBook(book_names.back())->GetContent().size();
+
+  for (size_t shard_count : {1, 16}) {
+    for (int thread_count : {1, 2, 4, 8}) {
+      auto unpacker = make_shared<BooksUnpacker>();
+      ICache::Settings settings;
+      settings.max_memory = 2 * hot_book_count * book_size;
+      settings.shard_count = shard_count;
+      auto cache = MakeCache(unpacker, settings);
+      {
+        LOG_DURATION(to_string(shard_count) + " shards, " + to_string(thread_count) + " threads");
+        vector<future<void>> tasks;
+        for (int task_num = 0; task_num < thread_count; ++task_num) {
+          tasks.push_back(async(launch::async, [&, task_num] {
+            mt19937 gen(task_num);
+            uniform_int_distribution<size_t> hot(0, hot_book_count - 1);
+            uniform_int_distribution<size_t> any(0, book_count - 1);
+            for (int i = 0; i < requests_per_thread; ++i) {
+              cache->GetBook(book_names[i % 10 ? hot(gen) : any(gen)]);
+            }
+          }));
+        }
+        for (auto& task : tasks) {
+          task.get();
+        }
+      }
+      cerr << "  " << unpacker->GetUnpackedBooksCount() << " unpacks for "
+           << thread_count * requests_per_thread << " requests" << endl;
+    }
+  }
+}
+
+
 int main() {
   BooksUnpacker unpacker;
   const Library lib(
@@ -210,6 +482,13 @@ int main() {
   RUN_CACHE_TEST(tr, TestCaching);
   RUN_CACHE_TEST(tr, TestSmallCache);
   RUN_CACHE_TEST(tr, TestAsync);
+  RUN_CACHE_TEST(tr, TestUnpackOnce);
+  RUN_CACHE_TEST(tr, TestShardedMaxMemory);
+  RUN_CACHE_TEST(tr, TestTinyLfuBasics);
+  RUN_CACHE_TEST(tr, TestTinyLfuScanResistance);
+  RUN_CACHE_TEST(tr, TestTinyLfuAdmitsAllOrNothing);
+  RUN_CACHE_TEST(tr, BenchmarkThroughput);
+  RUN_CACHE_TEST(tr, BenchmarkHitRatio);
 
 #undef RUN_CACHE_TEST
   return 0;
@@ -1,10 +1,21 @@
 #include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <future>
 #include <iostream>
+#include <iterator>
 #include <optional>
+#include <random>
+#include <sstream>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "../../profile.h"
+#include "../../test_runner.h"
+
 using namespace std;
 
 template<typename It>
@@ -129,6 +140,124 @@ private:
 };
 
 
+// Trie over the labels of the banned domains, from the top-level one down.
+// It owns a copy of the banned domains and checks a candidate right on its text:
+// labels are cut from the end of a string_view and looked up in one hash table
+// of edges, so no lookup allocates. A banned node has no children, since
+// everything below it is banned anyway.
+// Const methods may be called from several threads at once.
+class DomainTrie {
+public:
+  template <typename InputIt>
+  DomainTrie(InputIt domains_begin, InputIt domains_end) {
+    size_t text_size = 0;
+    for (string_view domain : Range(domains_begin, domains_end)) {
+      text_size += domain.size();
+    }
+    // Labels keep pointing into labels_text_, so it must never reallocate
+    labels_text_.reserve(text_size);
+    for (string_view domain : Range(domains_begin, domains_end)) {
+      AddDomain(domain);
+    }
+  }
+
+  DomainTrie(const DomainTrie&) = delete;
+  DomainTrie& operator=(const DomainTrie&) = delete;
+
+  // Check if candidate is subdomain of some domain
+  bool IsSubdomain(string_view candidate) const {
+    NodeId node = ROOT;
+    while (!is_banned_[node]) {
+      if (candidate.empty()) {
+        return false;
+      }
+      const auto it = edges_.find({node, CutLastLabel(candidate)});
+      if (it == edges_.end()) {
+        return false;
+      }
+      node = it->second;
+    }
+    return true;
+  }
+
+  // IsSubdomain for every candidate, split between thread_count threads
+  vector<bool> AreSubdomains(const vector<string_view>& candidates,
+                             size_t thread_count = thread::hardware_concurrency()) const {
+    thread_count = clamp<size_t>(candidates.size() / MIN_CANDIDATES_PER_THREAD, 1, max<size_t>(thread_count, 1));
+    const size_t chunk_size = (candidates.size() + thread_count - 1) / thread_count;
+    vector<future<vector<bool>>> chunks;
+    for (size_t chunk_begin = 0; chunk_begin < candidates.size(); chunk_begin += chunk_size) {
+      const size_t chunk_end = min(candidates.size(), chunk_begin + chunk_size);
+      chunks.push_back(async(launch::async, [this, &candidates, chunk_begin, chunk_end] {
+        vector<bool> results;
+        results.reserve(chunk_end - chunk_begin);
+        for (size_t i = chunk_begin; i < chunk_end; ++i) {
+          results.push_back(IsSubdomain(candidates[i]));
+        }
+        return results;
+      }));
+    }
+    vector<bool> results;
+    results.reserve(candidates.size());
+    for (auto& chunk : chunks) {
+      const vector<bool> chunk_results = chunk.get();
+      results.insert(end(results), begin(chunk_results), end(chunk_results));
+    }
+    return results;
+  }
+
+private:
+  using NodeId = uint32_t;
+  static const NodeId ROOT = 0;
+  static const size_t MIN_CANDIDATES_PER_THREAD = 10'000;
+
+  struct Edge {
+    NodeId parent;
+    string_view label;
+
+    bool operator==(const Edge& other) const {
+      return parent == other.parent && label == other.label;
+    }
+  };
+
+  struct EdgeHasher {
+    size_t operator()(const Edge& edge) const {
+      return hash<string_view>{}(edge.label) * 37 + edge.parent;
+    }
+  };
+
+  string labels_text_;
+  unordered_map<Edge, NodeId, EdgeHasher> edges_;
+  // Indexed by NodeId
+  vector<bool> is_banned_ = {false};
+
+  // Removes the last label and the dot before it from domain
+  static string_view CutLastLabel(string_view& domain) {
+    const size_t dot_pos = domain.rfind('.');
+    const string_view label = dot_pos == domain.npos ? domain : domain.substr(dot_pos + 1);
+    domain.remove_suffix(dot_pos == domain.npos ? domain.size() : domain.size() - dot_pos);
+    return label;
+  }
+
+  void AddDomain(string_view domain) {
+    const size_t text_begin = labels_text_.size();
+    labels_text_ += domain;
+    domain = string_view(labels_text_).substr(text_begin);
+
+    NodeId node = ROOT;
+    while (!domain.empty() && !is_banned_[node]) {
+      const auto [it, inserted] = edges_.try_emplace({node, CutLastLabel(domain)}, is_banned_.size());
+      if (inserted) {
+        is_banned_.push_back(false);
+      }
+      node = it->second;
+    }
+    // Subdomains banned before, if any, become unreachable
+    is_banned_[node] = true;
+  }
+};
+
+
 vector<Domain> ReadDomains(istream& in_stream = cin) {
   vector<Domain> domains;
 
@@ -156,15 +285,158 @@ vector<bool> CheckDomains(const vector<Domain>& banned_domains, const vector<Dom
   return check_results;
 }
 
+// Whitespace-separated words of text, e.g. of a whole input file
+vector<string_view> SplitIntoWords(string_view text) {
+  vector<string_view> words;
+  while (true) {
+    const size_t word_begin = text.find_first_not_of(" \t\r\n");
+    if (word_begin == text.npos) {
+      break;
+    }
+    text.remove_prefix(word_begin);
+    const size_t word_end = min(text.size(), text.find_first_of(" \t\r\n"));
+    words.push_back(text.substr(0, word_end));
+    text.remove_prefix(word_end);
+  }
+  return words;
+}
+
+// input is the whole input file: the banned domains and then the domains to check,
+// both lists preceded by their lengths. A missing length means an empty list,
+// and a list is cut short at the end of input.
+vector<bool> CheckDomainsText(string_view input, size_t thread_count = thread::hardware_concurrency()) {
+  const vector<string_view> words = SplitIntoWords(input);
+  auto read_list = [&words](size_t& pos) {
+    if (pos >= words.size()) {
+      return Range(end(words), end(words));
+    }
+    size_t count = 0;
+    from_chars(words[pos].data(), words[pos].data() + words[pos].size(), count);
+    count = min(count, words.size() - pos - 1);
+    const auto list_begin = begin(words) + pos + 1;
+    pos += count + 1;
+    return Range(list_begin, list_begin + count);
+  };
+  size_t pos = 0;
+  const auto banned_domains = read_list(pos);
+  const auto domains_to_check = read_list(pos);
+
+  const DomainTrie banned_trie(begin(banned_domains), end(banned_domains));
+  vector<bool> check_results = banned_trie.AreSubdomains(
+      vector<string_view>(begin(domains_to_check), end(domains_to_check)), thread_count
+  );
+  check_results.flip();
+  return check_results;
+}
+
 void PrintCheckResults(const vector<bool>& check_results, ostream& out_stream = cout) {
   for (const bool check_result : check_results) {
     out_stream << (check_result ? "Good" : "Bad") << "\n";
   }
 }
 
-int main() {
-  const vector<Domain> banned_domains = ReadDomains();
-  const vector<Domain> domains_to_check = ReadDomains();
-  PrintCheckResults(CheckDomains(banned_domains, domains_to_check));
+string GenerateDomain(mt19937& gen, int min_label_count, int max_label_count) {
+  static const string_view TOP_LEVEL_LABELS[] = {"com", "ru", "org", "net"};
+  uniform_int_distribution<int> label_count_dis(min_label_count, max_label_count);
+  uniform_int_distribution<int> label_length_dis(1, 3);
+  uniform_int_distribution<int> letter_dis('a', 'h');
+  string domain;
+  for (int label_count = label_count_dis(gen); label_count > 1; --label_count) {
+    for (int length = label_length_dis(gen); length > 0; --length) {
+      domain.push_back(static_cast<char>(letter_dis(gen)));
+    }
+    domain.push_back('.');
+  }
+  return domain += TOP_LEVEL_LABELS[uniform_int_distribution<size_t>(0, size(TOP_LEVEL_LABELS) - 1)(gen)];
+}
+
+void BenchmarkDomainCheckers() {
+  const size_t banned_count = 100'000;
+  const size_t check_count = 2'000'000;
+  mt19937 gen(42);
+  string input = to_string(banned_count) + "\n";
+  for (size_t i = 0; i < banned_count; ++i) {
+    input += GenerateDomain(gen, 2, 4) + "\n";
+  }
+  input += to_string(check_count) + "\n";
+  for (size_t i = 0; i < check_count; ++i) {
+    input += GenerateDomain(gen, 1, 6) + "\n";
+  }
+
+  vector<bool> sorted_results;
+  {
+    LOG_DURATION("DomainChecker");
+    istringstream input_stream(input);
+    const vector<Domain> banned_domains = ReadDomains(input_stream);
+    const vector<Domain> domains_to_check = ReadDomains(input_stream);
+    sorted_results = CheckDomains(banned_domains, domains_to_check);
+  }
+  for (size_t thread_count : {1, 4}) {
+    vector<bool> trie_results;
+    {
+      LOG_DURATION("DomainTrie, " + to_string(thread_count) + " threads");
+      trie_results = CheckDomainsText(input, thread_count);
+    }
+    cerr << "  " << count(begin(trie_results), end(trie_results), false) << " bad domains" << endl;
+    ASSERT(trie_results == sorted_results);
+  }
+}
+
+void TestDomainTrie() {
+  const vector<string_view> banned = {"ya.ru", "maps.me", "m.google.com"};
+  const DomainTrie trie(begin(banned), end(banned));
+  ASSERT(trie.IsSubdomain("ya.ru"));
+  ASSERT(trie.IsSubdomain("m.ya.ru"));
+  ASSERT(trie.IsSubdomain("a.b.maps.me"));
+  ASSERT(!trie.IsSubdomain("aya.ru"));
+  ASSERT(!trie.IsSubdomain("ru"));
+  ASSERT(!trie.IsSubdomain("google.com"));
+  ASSERT(!trie.IsSubdomain("me"));
+
+  const vector<string_view> banned_suffix = {"a.ru"};
+  const DomainTrie suffix_trie(begin(banned_suffix), end(banned_suffix));
+  ASSERT(!suffix_trie.IsSubdomain("ba.ru"));
+  ASSERT(suffix_trie.IsSubdomain("b.a.ru"));
+
+  const vector<string_view> no_banned;
+  const DomainTrie empty_trie(begin(no_banned), end(no_banned));
+  ASSERT(!empty_trie.IsSubdomain("ya.ru"));
+  ASSERT(!empty_trie.IsSubdomain(""));
+}
+
+void TestCheckDomainsText() {
+  ASSERT_EQUAL(CheckDomainsText("2 ya.ru a.ru 4 ya.ru m.ya.ru ba.ru a.ru.com"),
+               vector<bool>({false, false, true, true}));
+  ASSERT_EQUAL(CheckDomainsText("0\n2\nya.ru\nru\n"), vector<bool>({true, true}));
+  ASSERT_EQUAL(CheckDomainsText("2 ya.ru a.ru 4 m.ya.ru ba.ru a.ru.com b.a.ru", 2),
+               vector<bool>({false, true, true, false}));
+}
+
+void TestCheckDomainsTextMalformed() {
+  ASSERT_EQUAL(CheckDomainsText(""), vector<bool>());
+  ASSERT_EQUAL(CheckDomainsText("1 ya.ru"), vector<bool>());
+  ASSERT_EQUAL(CheckDomainsText("1 ya.ru 2 ya.ru"), vector<bool>({false}));
+  ASSERT_EQUAL(CheckDomainsText("5 ya.ru 1 ya.ru"), vector<bool>());
+}
+
+void TestAll() {
+  TestRunner tr;
+  RUN_TEST(tr, TestDomainTrie);
+  RUN_TEST(tr, TestCheckDomainsText);
+  RUN_TEST(tr, TestCheckDomainsTextMalformed);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && string_view(argv[1]) == "--test") {
+    TestAll();
+    return 0;
+  }
+  if (argc > 1 && string_view(argv[1]) == "--benchmark") {
+    TestRunner tr;
+    RUN_TEST(tr, BenchmarkDomainCheckers);
+    return 0;
+  }
+  const string input(istreambuf_iterator<char>(cin), {});
+  PrintCheckResults(CheckDomainsText(input));
   return 0;
 }
@@ -3,6 +3,10 @@
 #include <vector>
 #include <utility>
 #include <map>
+#include <random>
+#include <string_view>
+
+#include "../../profile.h"
 
 using namespace std;
 
@@ -60,14 +64,149 @@ private:
 };
 
 
-int main() {
+// То же самое, но за O(log MAX_PAGE_COUNT) на любой запрос и с ограничениями,
+// заданными при создании. Вместо числа пользователей, дочитавших хотя бы до
+// каждой страницы, хранится дерево Фенвика над числом пользователей,
+// остановившихся ровно на каждой странице: READ меняет две точки, а CHEER
+// считает сумму на префиксе
+class FenwickReadingManager {
+public:
+  explicit FenwickReadingManager(int max_user_count = 100'000, int max_page_count = 1'000)
+        // -1 значит, что не случилось ни одного READ
+      : user_page_counts_(max_user_count + 1, -1),
+        // Индексы в дереве сдвинуты на единицу: страница p хранится в p + 1
+        users_by_page_tree_(max_page_count + 2, 0) {}
+
+  void Read(int user_id, int page_count) {
+    int& user_page_count = user_page_counts_[user_id];
+    if (user_page_count == -1) {
+      ++user_count_;
+    } else {
+      AddUsers(user_page_count, -1);
+    }
+    AddUsers(page_count, 1);
+    user_page_count = page_count;
+  }
+
+  double Cheer(int user_id) const {
+    const int pages_count = user_page_counts_[user_id];
+    if (pages_count == -1) {
+      return 0;
+    }
+    if (user_count_ == 1) {
+      return 1;
+    }
+    return CountUsersBefore(pages_count) * 1.0 / (user_count_ - 1);
+  }
+
+private:
+  // Номер страницы, до которой дочитал пользователь <ключ>
+  vector<int> user_page_counts_;
+  vector<int> users_by_page_tree_;
+  int user_count_ = 0;
+
+  void AddUsers(int page, int delta) {
+    for (size_t i = page + 1; i < users_by_page_tree_.size(); i += i & -i) {
+      users_by_page_tree_[i] += delta;
+    }
+  }
+
+  // Сколько пользователей дочитали только до страниц меньше page
+  int CountUsersBefore(int page) const {
+    int count = 0;
+    for (size_t i = page; i > 0; i -= i & -i) {
+      count += users_by_page_tree_[i];
+    }
+    return count;
+  }
+};
+
+
+struct Query {
+  bool is_read;
+  int user_id;
+  int page_count;
+};
+
+// Пользователи читают книгу только вперёд, иногда перескакивая сразу
+// через десятую часть книги
+vector<Query> GenerateQueries(int user_count, int page_count, int query_count, uint32_t seed) {
+  mt19937 gen(seed);
+  uniform_int_distribution<int> user_dis(0, user_count - 1);
+  uniform_int_distribution<int> query_dis(0, 2);
+  uniform_int_distribution<int> jump_dis(1, max(1, page_count / 10));
+  vector<int> user_page_counts(user_count, 0);
+  vector<Query> queries;
+  queries.reserve(query_count);
+  for (int i = 0; i < query_count; ++i) {
+    const int user_id = user_dis(gen);
+    int& user_page_count = user_page_counts[user_id];
+    if (query_dis(gen) != 0 && user_page_count < page_count) {
+      user_page_count = min(page_count, user_page_count + jump_dis(gen));
+      queries.push_back({true, user_id, user_page_count});
+    } else {
+      queries.push_back({false, user_id, 0});
+    }
+  }
+  return queries;
+}
+
+template <typename Manager>
+double RunQueries(Manager& manager, const vector<Query>& queries) {
+  double cheer_sum = 0;
+  for (const Query& query : queries) {
+    if (query.is_read) {
+      manager.Read(query.user_id, query.page_count);
+    } else {
+      cheer_sum += manager.Cheer(query.user_id);
+    }
+  }
+  return cheer_sum;
+}
+
+void BenchmarkReadingManagers() {
+  const int query_count = 2'000'000;
+  {
+    // Самые большие ограничения, которые выдерживает ReadingManager
+    const auto queries = GenerateQueries(100'000, 1'000, query_count, 42);
+    ReadingManager manager;
+    FenwickReadingManager fenwick_manager;
+    double cheer_sum;
+    double fenwick_cheer_sum;
+    {
+      LOG_DURATION("ReadingManager, 1000 pages");
+      cheer_sum = RunQueries(manager, queries);
+    }
+    {
+      LOG_DURATION("FenwickReadingManager, 1000 pages");
+      fenwick_cheer_sum = RunQueries(fenwick_manager, queries);
+    }
+    cerr << "  cheer sums " << cheer_sum << " and " << fenwick_cheer_sum << endl;
+  }
+  {
+    const int user_count = 1'000'000;
+    const int page_count = 100'000;
+    const auto queries = GenerateQueries(user_count, page_count, query_count, 42);
+    FenwickReadingManager fenwick_manager(user_count, page_count);
+    LOG_DURATION("FenwickReadingManager, 10^6 users, 10^5 pages");
+    RunQueries(fenwick_manager, queries);
+  }
+}
+
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && string_view(argv[1]) == "--benchmark") {
+    BenchmarkReadingManagers();
+    return 0;
+  }
+
   // Для ускорения чтения данных отключается синхронизация
   // cin и cout с stdio,
   // а также выполняется отвязка cin от cout
   ios::sync_with_stdio(false);
   cin.tie(nullptr);
 
-  ReadingManager manager;
+  FenwickReadingManager manager;
 
   int query_count;
   cin >> query_count;
@@ -1,7 +1,15 @@
 #include <cstdint>
+#include <deque>
 #include <iostream>
 #include <map>
+#include <optional>
 #include <queue>
+#include <random>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../../profile.h"
 
 using namespace std;
 
@@ -73,11 +81,278 @@ private:
 };
 
 
-int main() {
+// Open addressing with linear probing, for keys that are never EMPTY_KEY.
+// Cells freed by erasing are filled by shifting the following cells back,
+// so lookups never walk over deleted cells
+class FlatCounter {
+public:
+  static const uint64_t EMPTY_KEY = UINT64_MAX;
+
+  // Returns true if key was not counted before
+  bool Increment(uint64_t key) {
+    if (2 * (size_ + 1) > cells_.size()) {
+      Grow();
+    }
+    Cell& cell = cells_[FindCell(key)];
+    if (cell.key == EMPTY_KEY) {
+      cell = {key, 1};
+      ++size_;
+      return true;
+    }
+    ++cell.count;
+    return false;
+  }
+
+  // key must be counted. Returns true if it is not counted anymore
+  bool Decrement(uint64_t key) {
+    size_t pos = FindCell(key);
+    if (--cells_[pos].count > 0) {
+      return false;
+    }
+    // Backward shift: move up every following cell that may live in the freed one
+    for (size_t next = (pos + 1) & mask_; cells_[next].key != EMPTY_KEY; next = (next + 1) & mask_) {
+      const size_t home = GetHome(cells_[next].key);
+      if (((next - home) & mask_) >= ((next - pos) & mask_)) {
+        cells_[pos] = cells_[next];
+        pos = next;
+      }
+    }
+    cells_[pos].key = EMPTY_KEY;
+    --size_;
+    return true;
+  }
+
+private:
+  struct Cell {
+    uint64_t key = EMPTY_KEY;
+    int count = 0;
+  };
+
+  vector<Cell> cells_ = vector<Cell>(16);
+  size_t mask_ = 15;
+  int shift_ = 60;
+  size_t size_ = 0;
+
+  size_t GetHome(uint64_t key) const {
+    return (key * 0x9E3779B97F4A7C15ull) >> shift_;
+  }
+
+  size_t FindCell(uint64_t key) const {
+    size_t pos = GetHome(key);
+    while (cells_[pos].key != EMPTY_KEY && cells_[pos].key != key) {
+      pos = (pos + 1) & mask_;
+    }
+    return pos;
+  }
+
+  void Grow() {
+    vector<Cell> old_cells(2 * cells_.size());
+    swap(cells_, old_cells);
+    mask_ = cells_.size() - 1;
+    --shift_;
+    for (const Cell& cell : old_cells) {
+      if (cell.key != EMPTY_KEY) {
+        cells_[FindCell(cell.key)] = cell;
+      }
+    }
+  }
+};
+
+
+// Same answers as HotelManager, but queries are const and never add hotels.
+// Bookings of all hotels go to one ring buffer in time order, and those that
+// leave the window are removed as soon as a later booking arrives, so a query
+// just reads two counters. Hotel names are interned once, and the numbers of
+// bookings per hotel and client live in one FlatCounter
+class FastHotelManager {
+public:
+  void Book(int64_t time, string_view hotel_name, int client_id, int room_count) {
+    RemoveOldBookings(time);
+    const HotelId hotel_id = InternHotel(hotel_name);
+    HotelInfo& hotel = hotels_[hotel_id];
+    hotel.room_count += room_count;
+    if (client_counts_.Increment(MakeClientKey(hotel_id, client_id))) {
+      ++hotel.client_count;
+    }
+    PushBooking({time, hotel_id, client_id, room_count});
+  }
+
+  int ComputeClientCount(string_view hotel_name) const {
+    const auto hotel_id = FindHotel(hotel_name);
+    return hotel_id ? hotels_[*hotel_id].client_count : 0;
+  }
+
+  int ComputeRoomCount(string_view hotel_name) const {
+    const auto hotel_id = FindHotel(hotel_name);
+    return hotel_id ? hotels_[*hotel_id].room_count : 0;
+  }
+
+private:
+  using HotelId = uint32_t;
+  static const int TIME_WINDOW_SIZE = 86400;
+
+  struct Booking {
+    int64_t time;
+    HotelId hotel_id;
+    int client_id;
+    int room_count;
+  };
+
+  struct HotelInfo {
+    int client_count = 0;
+    int room_count = 0;
+  };
+
+  // Keys point into hotel_names_
+  unordered_map<string_view, HotelId> hotel_ids_;
+  deque<string> hotel_names_;
+  // Indexed by HotelId
+  vector<HotelInfo> hotels_;
+  FlatCounter client_counts_;
+
+  // Bookings within the window from the oldest one; the capacity is a power of two
+  vector<Booking> bookings_ = vector<Booking>(16);
+  size_t first_booking_ = 0;
+  size_t booking_count_ = 0;
+
+  static uint64_t MakeClientKey(HotelId hotel_id, int client_id) {
+    return (uint64_t(hotel_id) << 32) | uint32_t(client_id);
+  }
+
+  optional<HotelId> FindHotel(string_view hotel_name) const {
+    const auto it = hotel_ids_.find(hotel_name);
+    return it == hotel_ids_.end() ? nullopt : optional(it->second);
+  }
+
+  HotelId InternHotel(string_view hotel_name) {
+    if (const auto hotel_id = FindHotel(hotel_name)) {
+      return *hotel_id;
+    }
+    const HotelId hotel_id = hotels_.size();
+    hotel_ids_.emplace(hotel_names_.emplace_back(hotel_name), hotel_id);
+    hotels_.emplace_back();
+    return hotel_id;
+  }
+
+  void PushBooking(const Booking& booking) {
+    if (booking_count_ == bookings_.size()) {
+      vector<Booking> bookings(2 * bookings_.size());
+      for (size_t i = 0; i < booking_count_; ++i) {
+        bookings[i] = bookings_[(first_booking_ + i) & (bookings_.size() - 1)];
+      }
+      bookings_ = move(bookings);
+      first_booking_ = 0;
+    }
+    bookings_[(first_booking_ + booking_count_) & (bookings_.size() - 1)] = booking;
+    ++booking_count_;
+  }
+
+  void RemoveOldBookings(int64_t current_time) {
+    while (booking_count_ > 0 && bookings_[first_booking_].time <= current_time - TIME_WINDOW_SIZE) {
+      const Booking& booking = bookings_[first_booking_];
+      HotelInfo& hotel = hotels_[booking.hotel_id];
+      hotel.room_count -= booking.room_count;
+      if (client_counts_.Decrement(MakeClientKey(booking.hotel_id, booking.client_id))) {
+        --hotel.client_count;
+      }
+      first_booking_ = (first_booking_ + 1) & (bookings_.size() - 1);
+      --booking_count_;
+    }
+  }
+};
+
+
+struct Query {
+  enum class Type {
+    BOOK,
+    CLIENTS,
+    ROOMS
+  };
+
+  Type type;
+  int64_t time;
+  size_t hotel_index;
+  int client_id;
+  int room_count;
+};
+
+// Half of the queries are bookings, a second apart on average, so that the window
+// holds about 43200 of them. Queries also ask about hotels that were never booked
+vector<Query> GenerateQueries(size_t hotel_count, int client_count, size_t query_count, uint32_t seed) {
+  mt19937 gen(seed);
+  uniform_int_distribution<int> type_dis(0, 3);
+  uniform_int_distribution<int> time_step_dis(0, 2);
+  uniform_int_distribution<size_t> hotel_dis(0, hotel_count - 1);
+  uniform_int_distribution<size_t> queried_hotel_dis(0, 2 * hotel_count - 1);
+  uniform_int_distribution<int> client_dis(1, client_count);
+  uniform_int_distribution<int> room_count_dis(1, 10);
+  vector<Query> queries;
+  queries.reserve(query_count);
+  int64_t time = 0;
+  for (size_t i = 0; i < query_count; ++i) {
+    const int type = type_dis(gen);
+    if (type < 2) {
+      time += time_step_dis(gen);
+      queries.push_back({Query::Type::BOOK, time, hotel_dis(gen), client_dis(gen), room_count_dis(gen)});
+    } else {
+      queries.push_back({type == 2 ? Query::Type::CLIENTS : Query::Type::ROOMS, 0, queried_hotel_dis(gen), 0, 0});
+    }
+  }
+  return queries;
+}
+
+template <typename Manager>
+int64_t RunQueries(Manager& manager, const vector<Query>& queries, const vector<string>& hotel_names) {
+  int64_t checksum = 0;
+  for (const Query& query : queries) {
+    const string& hotel_name = hotel_names[query.hotel_index];
+    if (query.type == Query::Type::BOOK) {
+      manager.Book(query.time, hotel_name, query.client_id, query.room_count);
+    } else if (query.type == Query::Type::CLIENTS) {
+      checksum += manager.ComputeClientCount(hotel_name);
+    } else {
+      checksum += manager.ComputeRoomCount(hotel_name);
+    }
+  }
+  return checksum;
+}
+
+void BenchmarkHotelManagers() {
+  const size_t hotel_count = 10'000;
+  const int client_count = 1'000'000;
+  const size_t query_count = 4'000'000;
+  vector<string> hotel_names;
+  for (size_t i = 0; i < 2 * hotel_count; ++i) {
+    hotel_names.push_back("hotel_" + to_string(i));
+  }
+  const auto queries = GenerateQueries(hotel_count, client_count, query_count, 42);
+
+  int64_t checksum;
+  int64_t fast_checksum;
+  {
+    HotelManager manager;
+    LOG_DURATION("HotelManager");
+    checksum = RunQueries(manager, queries, hotel_names);
+  }
+  {
+    FastHotelManager manager;
+    LOG_DURATION("FastHotelManager");
+    fast_checksum = RunQueries(manager, queries, hotel_names);
+  }
+  cerr << "  checksums " << checksum << " and " << fast_checksum << endl;
+}
+
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && string_view(argv[1]) == "--benchmark") {
+    BenchmarkHotelManagers();
+    return 0;
+  }
+
   ios::sync_with_stdio(false);
   cin.tie(nullptr);
   
-  HotelManager manager;
+  FastHotelManager manager;
 
   int query_count;
   cin >> query_count;
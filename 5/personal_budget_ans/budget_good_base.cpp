@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <array>
+#include <charconv>
 #include <cmath>
 #include <cstdint>
 #include <ctime>
@@ -5,7 +8,9 @@
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <numeric>
 #include <optional>
+#include <random>
 #include <sstream>
 #include <string>
 #include <system_error>
@@ -13,6 +18,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "../../profile.h"
+
 using namespace std;
 
 template<typename It>
@@ -48,9 +55,14 @@ string_view ReadToken(string_view& s, string_view delimiter = " ") {
 }
 
 int ConvertToInt(string_view str) {
-  // use std::from_chars when available to get rid of string copy
-  size_t pos;
-  const int result = stoi(string(str), &pos);
+  int result;
+  const auto [ptr, error_code] = from_chars(str.data(), str.data() + str.size(), result);
+  if (error_code == errc::invalid_argument) {
+    throw invalid_argument("string " + string(str) + " is not a number");
+  } else if (error_code == errc::result_out_of_range) {
+    throw out_of_range("string " + string(str) + " is out of int range");
+  }
+  const size_t pos = ptr - str.data();
   if (pos != str.length()) {
     std::stringstream error;
     error << "string " << str << " contains " << (str.length() - pos) << " trailing chars";
@@ -260,8 +272,162 @@ private:
 };
 
 
+// The same tree stored in one array in heap order: node v has children 2v and 2v + 1,
+// and node segments are computed on the way down instead of being kept in the nodes.
+// ComputeSum does not push postponed operations down, it applies them to the partial
+// sums instead, so BulkOperation::Collapse has to be linear in origin and in segment length.
+template <typename Data, typename BulkOperation>
+class FlatSummingSegmentTree {
+public:
+  FlatSummingSegmentTree(size_t size) : size_(size), nodes_(size == 0 ? 0 : 4 * size) {}
+
+  // Leaf i stands for the indexes [boundaries[i], boundaries[i + 1]), so that a tree over
+  // coordinates compressed to these boundaries sees the original segments in BulkOperation
+  explicit FlatSummingSegmentTree(vector<size_t> boundaries)
+      : size_(boundaries.empty() ? 0 : boundaries.size() - 1)
+      , nodes_(4 * size_)
+      , boundaries_(move(boundaries))
+  {}
+
+  Data ComputeSum(IndexSegment segment) const {
+    return size_ == 0 ? Data() : ComputeSum(1, {0, size_}, segment);
+  }
+
+  void AddBulkOperation(IndexSegment segment, const BulkOperation& operation) {
+    if (size_ != 0) {
+      AddBulkOperation(1, {0, size_}, segment, operation);
+    }
+  }
+
+  // Values of the single leaves with all postponed operations applied, in O(size)
+  vector<Data> ComputeLeafSums() const {
+    vector<Data> sums(size_);
+    if (size_ != 0) {
+      ComputeLeafSums(1, {0, size_}, BulkOperation(), sums);
+    }
+    return sums;
+  }
+
+  // Replaces the whole tree, in O(size)
+  void AssignLeaves(const vector<Data>& values) {
+    if (size_ != 0) {
+      AssignLeaves(1, {0, size_}, values);
+    }
+  }
+
+private:
+  struct Node {
+    Data data;
+    BulkOperation postponed_bulk_operation;
+  };
+
+  size_t size_;
+  vector<Node> nodes_;
+  // Empty if leaves are single indexes
+  vector<size_t> boundaries_;
+
+  IndexSegment ToOriginalSegment(IndexSegment segment) const {
+    return boundaries_.empty() ? segment : IndexSegment{boundaries_[segment.left], boundaries_[segment.right]};
+  }
+
+  static pair<IndexSegment, IndexSegment> SplitSegment(IndexSegment segment) {
+    const size_t middle = segment.left + segment.length() / 2;
+    return {{segment.left, middle}, {middle, segment.right}};
+  }
+
+  Data ComputeSum(size_t node, IndexSegment node_segment, IndexSegment query_segment) const {
+    if (!AreSegmentsIntersected(node_segment, query_segment)) {
+      return {};
+    }
+    if (query_segment.Contains(node_segment)) {
+      return nodes_[node].data;
+    }
+    const auto [left_segment, right_segment] = SplitSegment(node_segment);
+    const Data children_sum = ComputeSum(2 * node, left_segment, query_segment)
+        + ComputeSum(2 * node + 1, right_segment, query_segment);
+    return nodes_[node].postponed_bulk_operation.Collapse(
+        children_sum, ToOriginalSegment(IntersectSegments(node_segment, query_segment))
+    );
+  }
+
+  void AddBulkOperation(size_t node, IndexSegment node_segment, IndexSegment query_segment,
+                        const BulkOperation& operation) {
+    if (!AreSegmentsIntersected(node_segment, query_segment)) {
+      return;
+    }
+    if (query_segment.Contains(node_segment)) {
+      nodes_[node].postponed_bulk_operation.CombineWith(operation);
+      nodes_[node].data = operation.Collapse(nodes_[node].data, ToOriginalSegment(node_segment));
+      return;
+    }
+    const auto [left_segment, right_segment] = SplitSegment(node_segment);
+    PropagateBulkOperation(node, left_segment, right_segment);
+    AddBulkOperation(2 * node, left_segment, query_segment, operation);
+    AddBulkOperation(2 * node + 1, right_segment, query_segment, operation);
+    nodes_[node].data = nodes_[2 * node].data + nodes_[2 * node + 1].data;
+  }
+
+  void PropagateBulkOperation(size_t node, IndexSegment left_segment, IndexSegment right_segment) {
+    const BulkOperation& operation = nodes_[node].postponed_bulk_operation;
+    for (const auto& [child, child_segment] : {pair{2 * node, left_segment}, pair{2 * node + 1, right_segment}}) {
+      nodes_[child].postponed_bulk_operation.CombineWith(operation);
+      nodes_[child].data = operation.Collapse(nodes_[child].data, ToOriginalSegment(child_segment));
+    }
+    nodes_[node].postponed_bulk_operation = BulkOperation();
+  }
+
+  // pending holds the operations of the ancestors that are not applied to this node yet
+  void ComputeLeafSums(size_t node, IndexSegment node_segment, const BulkOperation& pending,
+                       vector<Data>& sums) const {
+    if (node_segment.length() == 1) {
+      sums[node_segment.left] = pending.Collapse(nodes_[node].data, ToOriginalSegment(node_segment));
+      return;
+    }
+    BulkOperation children_pending = nodes_[node].postponed_bulk_operation;
+    children_pending.CombineWith(pending);
+    const auto [left_segment, right_segment] = SplitSegment(node_segment);
+    ComputeLeafSums(2 * node, left_segment, children_pending, sums);
+    ComputeLeafSums(2 * node + 1, right_segment, children_pending, sums);
+  }
+
+  void AssignLeaves(size_t node, IndexSegment node_segment, const vector<Data>& values) {
+    nodes_[node].postponed_bulk_operation = BulkOperation();
+    if (node_segment.length() == 1) {
+      nodes_[node].data = values[node_segment.left];
+      return;
+    }
+    const auto [left_segment, right_segment] = SplitSegment(node_segment);
+    AssignLeaves(2 * node, left_segment, values);
+    AssignLeaves(2 * node + 1, right_segment, values);
+    nodes_[node].data = nodes_[2 * node].data + nodes_[2 * node + 1].data;
+  }
+};
+
+
+// Days since 1970-01-01 in the proleptic Gregorian calendar. Days past the end
+// of the month roll over to the next one, as mktime does.
+// Years are shifted to start in March, so that the leap day is the last day of a year
+constexpr int ComputeCivilDays(int year, int month, int day) {
+  year -= month <= 2;
+  const int era = (year >= 0 ? year : year - 399) / 400;
+  const int year_of_era = year - era * 400;                                     // [0, 399]
+  const int day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+static_assert(ComputeCivilDays(1970, 1, 1) == 0);
+static_assert(ComputeCivilDays(2000, 3, 1) - ComputeCivilDays(2000, 2, 28) == 2);
+static_assert(ComputeCivilDays(2100, 3, 1) - ComputeCivilDays(2100, 2, 28) == 1);
+static_assert(ComputeCivilDays(2000, 2, 31) == ComputeCivilDays(2000, 3, 2));
+static_assert(ComputeCivilDays(2100, 1, 1) - ComputeCivilDays(2000, 1, 1) == 36525);
+
 class Date {
 public:
+  constexpr Date(int year, int month, int day)
+      : year_(year), month_(month), day_(day)
+  {}
+
   static Date FromString(string_view str) {
     const int year = ConvertToInt(ReadToken(str, "-"));
     const int month = ConvertToInt(ReadToken(str, "-"));
@@ -271,6 +437,10 @@ public:
     return {year, month, day};
   }
 
+  constexpr int AsCivilDays() const {
+    return ComputeCivilDays(year_, month_, day_);
+  }
+
   // Weird legacy, can't wait for std::chrono::year_month_day
   time_t AsTimestamp() const {
     std::tm t;
@@ -288,22 +458,15 @@ private:
   int year_;
   int month_;
   int day_;
-
-  Date(int year, int month, int day)
-      : year_(year), month_(month), day_(day)
-  {}
 };
 
 int ComputeDaysDiff(const Date& date_to, const Date& date_from) {
-  const time_t timestamp_to = date_to.AsTimestamp();
-  const time_t timestamp_from = date_from.AsTimestamp();
-  static constexpr int SECONDS_IN_DAY = 60 * 60 * 24;
-  return (timestamp_to - timestamp_from) / SECONDS_IN_DAY;
+  return date_to.AsCivilDays() - date_from.AsCivilDays();
 }
 
-static const Date START_DATE = Date::FromString("2000-01-01");
-static const Date END_DATE = Date::FromString("2100-01-01");
-static const size_t DAY_COUNT = ComputeDaysDiff(END_DATE, START_DATE);
+static constexpr Date START_DATE(2000, 1, 1);
+static constexpr Date END_DATE(2100, 1, 1);
+static constexpr size_t DAY_COUNT = END_DATE.AsCivilDays() - START_DATE.AsCivilDays();
 
 size_t ComputeDayIndex(const Date& date) {
   return ComputeDaysDiff(date, START_DATE);
@@ -314,9 +477,9 @@ IndexSegment MakeDateSegment(const Date& date_from, const Date& date_to) {
 }
 
 
-class BudgetManager : public SummingSegmentTree<double, BulkLinearUpdater> {
+class BudgetManager : public FlatSummingSegmentTree<double, BulkLinearUpdater> {
 public:
-    BudgetManager() : SummingSegmentTree(DAY_COUNT) {}
+    BudgetManager() : FlatSummingSegmentTree(DAY_COUNT) {}
 };
 
 
@@ -478,16 +641,362 @@ vector<double> ProcessRequests(const vector<RequestHolder>& requests) {
   return responses;
 }
 
+IndexSegment GetRequestDateSegment(const Request& request) {
+  switch (request.type) {
+    case Request::Type::COMPUTE_INCOME: {
+      const auto& typed_request = static_cast<const ComputeIncomeRequest&>(request);
+      return MakeDateSegment(typed_request.date_from, typed_request.date_to);
+    }
+    case Request::Type::EARN: {
+      const auto& typed_request = static_cast<const EarnRequest&>(request);
+      return MakeDateSegment(typed_request.date_from, typed_request.date_to);
+    }
+    case Request::Type::PAY_TAX:
+    default: {
+      const auto& typed_request = static_cast<const PayTaxRequest&>(request);
+      return MakeDateSegment(typed_request.date_from, typed_request.date_to);
+    }
+  }
+}
+
+// A sweep over all leaves costs about as much as this many tree operations per leaf
+constexpr size_t LEAVES_PER_TREE_OPERATION = 16;
+
+// Same answers as ProcessRequests for a batch known up front.
+// Days are compressed to the boundaries of the requested segments, so the tree has
+// a leaf per piece of the calendar that no request splits rather than a leaf per day.
+// Long runs of Earn requests are summed in a difference array and written into the
+// leaves at once, long runs of ComputeIncome requests are answered from prefix sums
+// over the leaves. PayTax requests and short runs go to the tree one by one
+vector<double> ProcessRequestsOffline(const vector<RequestHolder>& requests) {
+  vector<IndexSegment> segments;
+  segments.reserve(requests.size());
+  // Days are few, so compressed indexes are looked up in a table rather than searched
+  vector<size_t> compressed_days(DAY_COUNT + 1);
+  for (const auto& request : requests) {
+    segments.push_back(GetRequestDateSegment(*request));
+    compressed_days[segments.back().left] = 1;
+    compressed_days[segments.back().right] = 1;
+  }
+  vector<size_t> boundaries;
+  for (size_t day = 0; day <= DAY_COUNT; ++day) {
+    if (compressed_days[day]) {
+      compressed_days[day] = boundaries.size();
+      boundaries.push_back(day);
+    }
+  }
+  // Compression that hardly shrinks the calendar only slows the tree down
+  const bool are_days_compressed = 2 * boundaries.size() <= DAY_COUNT;
+  if (!are_days_compressed) {
+    boundaries.resize(DAY_COUNT + 1);
+    iota(begin(boundaries), end(boundaries), 0);
+    iota(begin(compressed_days), end(compressed_days), 0);
+  }
+  auto compress = [&compressed_days](size_t day) {
+    return compressed_days[day];
+  };
+
+  const size_t leaf_count = boundaries.empty() ? 0 : boundaries.size() - 1;
+  auto find_run_end = [&requests](size_t run_begin) {
+    size_t run_end = run_begin;
+    while (run_end < requests.size() && requests[run_end]->type == requests[run_begin]->type) {
+      ++run_end;
+    }
+    return run_end;
+  };
+  auto is_sweep = [leaf_count](Request::Type type, size_t run_length) {
+    return type != Request::Type::PAY_TAX && run_length * LEAVES_PER_TREE_OPERATION >= leaf_count;
+  };
+
+  // Without compression and sweeps this would be the online algorithm with extra work
+  if (!are_days_compressed) {
+    size_t swept_count = 0;
+    for (size_t run_begin = 0; run_begin < requests.size(); ) {
+      const size_t run_end = find_run_end(run_begin);
+      if (is_sweep(requests[run_begin]->type, run_end - run_begin)) {
+        swept_count += run_end - run_begin;
+      }
+      run_begin = run_end;
+    }
+    if (2 * swept_count < requests.size()) {
+      return ProcessRequests(requests);
+    }
+  }
+
+  using Tree = FlatSummingSegmentTree<double, BulkLinearUpdater>;
+  Tree tree = are_days_compressed ? Tree(boundaries) : Tree(DAY_COUNT);
+  vector<double> responses;
+  for (size_t run_begin = 0; run_begin < requests.size(); ) {
+    const Request::Type type = requests[run_begin]->type;
+    const size_t run_end = find_run_end(run_begin);
+    const bool sweep = is_sweep(type, run_end - run_begin);
+
+    if (!sweep) {
+      for (size_t i = run_begin; i < run_end; ++i) {
+        const IndexSegment leaves{compress(segments[i].left), compress(segments[i].right)};
+        if (type == Request::Type::COMPUTE_INCOME) {
+          responses.push_back(tree.ComputeSum(leaves));
+        } else if (type == Request::Type::EARN) {
+          const auto& request = static_cast<const EarnRequest&>(*requests[i]);
+          tree.AddBulkOperation(leaves, BulkMoneyAdder{request.income * 1.0 / segments[i].length()});
+        } else {
+          tree.AddBulkOperation(leaves, BulkTaxApplier{1});
+        }
+      }
+    } else if (type == Request::Type::EARN) {
+      // Daily income changes at the leaf boundaries
+      vector<double> daily_income_changes(leaf_count + 1);
+      for (size_t i = run_begin; i < run_end; ++i) {
+        const auto& request = static_cast<const EarnRequest&>(*requests[i]);
+        const double daily_income = request.income * 1.0 / segments[i].length();
+        daily_income_changes[compress(segments[i].left)] += daily_income;
+        daily_income_changes[compress(segments[i].right)] -= daily_income;
+      }
+      vector<double> leaf_sums = tree.ComputeLeafSums();
+      double daily_income = 0;
+      for (size_t leaf = 0; leaf < leaf_count; ++leaf) {
+        daily_income += daily_income_changes[leaf];
+        leaf_sums[leaf] += daily_income * (boundaries[leaf + 1] - boundaries[leaf]);
+      }
+      tree.AssignLeaves(leaf_sums);
+    } else {
+      const vector<double> leaf_sums = tree.ComputeLeafSums();
+      // long double, so that the difference of two large prefix sums keeps small answers exact
+      vector<long double> prefix_sums(leaf_count + 1);
+      for (size_t leaf = 0; leaf < leaf_count; ++leaf) {
+        prefix_sums[leaf + 1] = prefix_sums[leaf] + leaf_sums[leaf];
+      }
+      for (size_t i = run_begin; i < run_end; ++i) {
+        responses.push_back(prefix_sums[compress(segments[i].right)] - prefix_sums[compress(segments[i].left)]);
+      }
+    }
+    run_begin = run_end;
+  }
+  return responses;
+}
+
 void PrintResponses(const vector<double>& responses, ostream& stream = cout) {
   for (const double response : responses) {
     stream << response << endl;
   }
 }
 
-int main() {
+string GenerateRequests(size_t request_count, uint32_t seed) {
+  mt19937 gen(seed);
+  uniform_int_distribution<int> type_dis(0, 9);
+  uniform_int_distribution<int> year_dis(2000, 2099);
+  uniform_int_distribution<int> month_dis(1, 12);
+  uniform_int_distribution<int> day_dis(1, 28);
+  uniform_int_distribution<int> income_dis(1, 1000000);
+  auto generate_dates = [&] {
+    array<int, 3> date_from = {year_dis(gen), month_dis(gen), day_dis(gen)};
+    array<int, 3> date_to = {year_dis(gen), month_dis(gen), day_dis(gen)};
+    if (date_from > date_to) {
+      swap(date_from, date_to);
+    }
+    stringstream dates;
+    dates << date_from[0] << '-' << date_from[1] << '-' << date_from[2] << ' '
+          << date_to[0] << '-' << date_to[1] << '-' << date_to[2];
+    return dates.str();
+  };
+
+  stringstream requests;
+  requests << request_count << '\n';
+  for (size_t i = 0; i < request_count; ++i) {
+    // 40% Earn, 20% PayTax, 40% ComputeIncome
+    const int type = type_dis(gen);
+    if (type < 4) {
+      requests << "Earn " << generate_dates() << ' ' << income_dis(gen) << '\n';
+    } else if (type < 6) {
+      requests << "PayTax " << generate_dates() << '\n';
+    } else {
+      requests << "ComputeIncome " << generate_dates() << '\n';
+    }
+  }
+  return requests.str();
+}
+
+// A nightly batch: monthly incomes, then yearly taxes, then reports
+string GenerateBatchRequests(size_t earn_count, size_t compute_income_count, uint32_t seed) {
+  mt19937 gen(seed);
+  uniform_int_distribution<int> year_dis(2000, 2099);
+  uniform_int_distribution<int> month_dis(1, 12);
+  uniform_int_distribution<int> income_dis(1, 1000000);
+
+  stringstream requests;
+  requests << earn_count + 100 + compute_income_count << '\n';
+  for (size_t i = 0; i < earn_count; ++i) {
+    const int year = year_dis(gen);
+    const int month = month_dis(gen);
+    requests << "Earn " << year << '-' << month << "-1 " << year << '-' << month << "-28 "
+             << income_dis(gen) << '\n';
+  }
+  for (int year = 2000; year < 2100; ++year) {
+    requests << "PayTax " << year << "-1-1 " << year << "-12-31\n";
+  }
+  for (size_t i = 0; i < compute_income_count; ++i) {
+    array<int, 2> month_from = {year_dis(gen), month_dis(gen)};
+    array<int, 2> month_to = {year_dis(gen), month_dis(gen)};
+    if (month_from > month_to) {
+      swap(month_from, month_to);
+    }
+    requests << "ComputeIncome " << month_from[0] << '-' << month_from[1] << "-1 "
+             << month_to[0] << '-' << month_to[1] << "-28\n";
+  }
+  return requests.str();
+}
+
+void BenchmarkOffline() {
+  const pair<string, string> traces[] = {
+      {"mixed", GenerateRequests(1000000, 42)},
+      {"batch", GenerateBatchRequests(400000, 600000, 42)},
+  };
+  for (const auto& [trace_name, trace] : traces) {
+    istringstream input(trace);
+    const vector<RequestHolder> requests = ReadRequests(input);
+    vector<double> online_responses;
+    vector<double> offline_responses;
+    {
+      LOG_DURATION("online, " + trace_name);
+      online_responses = ProcessRequests(requests);
+    }
+    {
+      LOG_DURATION("offline, " + trace_name);
+      offline_responses = ProcessRequestsOffline(requests);
+    }
+    double max_error = 0;
+    for (size_t i = 0; i < online_responses.size(); ++i) {
+      max_error = max(max_error, abs(online_responses[i] - offline_responses[i]) / max(1., abs(online_responses[i])));
+    }
+    cerr << "  max relative difference " << max_error << endl;
+  }
+}
+
+struct TreeOperation {
+  IndexSegment segment;
+  // Nothing for sum queries
+  optional<BulkLinearUpdater> operation;
+};
+
+template <typename Tree>
+double ApplyTreeOperations(const vector<TreeOperation>& operations) {
+  Tree tree(DAY_COUNT);
+  double checksum = 0;
+  for (const auto& [segment, operation] : operations) {
+    if (operation) {
+      tree.AddBulkOperation(segment, *operation);
+    } else {
+      checksum += tree.ComputeSum(segment);
+    }
+  }
+  return checksum;
+}
+
+void BenchmarkSegmentTrees() {
+  const size_t request_count = 1000000;
+  istringstream input(GenerateRequests(request_count, 42));
+  vector<RequestHolder> requests;
+  vector<double> responses;
+  {
+    LOG_DURATION("parse " + to_string(request_count) + " requests");
+    requests = ReadRequests(input);
+  }
+  {
+    LOG_DURATION("process " + to_string(request_count) + " requests");
+    responses = ProcessRequests(requests);
+  }
+
+  vector<TreeOperation> operations;
+  operations.reserve(requests.size());
+  for (const auto& request_holder : requests) {
+    if (request_holder->type == Request::Type::COMPUTE_INCOME) {
+      const auto& request = static_cast<const ComputeIncomeRequest&>(*request_holder);
+      operations.push_back({MakeDateSegment(request.date_from, request.date_to), nullopt});
+    } else if (request_holder->type == Request::Type::EARN) {
+      const auto& request = static_cast<const EarnRequest&>(*request_holder);
+      const auto segment = MakeDateSegment(request.date_from, request.date_to);
+      operations.push_back({segment, BulkMoneyAdder{request.income * 1.0 / segment.length()}});
+    } else {
+      const auto& request = static_cast<const PayTaxRequest&>(*request_holder);
+      operations.push_back({MakeDateSegment(request.date_from, request.date_to), BulkTaxApplier{1}});
+    }
+  }
+  double pointer_checksum;
+  double flat_checksum;
+  {
+    LOG_DURATION("SummingSegmentTree");
+    pointer_checksum = ApplyTreeOperations<SummingSegmentTree<double, BulkLinearUpdater>>(operations);
+  }
+  {
+    LOG_DURATION("FlatSummingSegmentTree");
+    flat_checksum = ApplyTreeOperations<FlatSummingSegmentTree<double, BulkLinearUpdater>>(operations);
+  }
+  cerr << "checksums " << pointer_checksum << " and " << flat_checksum << endl;
+}
+
+// Date parsing as it was before ComputeCivilDays: stoi on a string copy
+// and mktime twice per date
+Date ParseDateWithStoi(string_view str) {
+  const int year = stoi(string(ReadToken(str, "-")));
+  const int month = stoi(string(ReadToken(str, "-")));
+  ValidateBounds(month, 1, 12);
+  const int day = stoi(string(str));
+  ValidateBounds(day, 1, 31);
+  return {year, month, day};
+}
+
+IndexSegment MakeDateSegmentWithMktime(const Date& date_from, const Date& date_to) {
+  static constexpr int SECONDS_IN_DAY = 60 * 60 * 24;
+  auto compute_day_index = [](const Date& date) -> size_t {
+    return (date.AsTimestamp() - START_DATE.AsTimestamp()) / SECONDS_IN_DAY;
+  };
+  return {compute_day_index(date_from), compute_day_index(date_to) + 1};
+}
+
+void BenchmarkDateParsing() {
+  const size_t request_count = 1000000;
+  istringstream input(GenerateRequests(request_count, 42));
+  ReadNumberOnLine<size_t>(input);
+  vector<string> lines(request_count);
+  for (string& line : lines) {
+    getline(input, line);
+  }
+
+  size_t mktime_checksum = 0;
+  {
+    LOG_DURATION("mktime and stoi");
+    for (string_view line : lines) {
+      ReadToken(line);
+      const Date date_from = ParseDateWithStoi(ReadToken(line));
+      const Date date_to = ParseDateWithStoi(ReadToken(line));
+      mktime_checksum += MakeDateSegmentWithMktime(date_from, date_to).length();
+    }
+  }
+  size_t civil_days_checksum = 0;
+  {
+    LOG_DURATION("civil days and from_chars");
+    for (string_view line : lines) {
+      ReadToken(line);
+      const Date date_from = Date::FromString(ReadToken(line));
+      const Date date_to = Date::FromString(ReadToken(line));
+      civil_days_checksum += MakeDateSegment(date_from, date_to).length();
+    }
+  }
+  cerr << "checksums " << mktime_checksum << " and " << civil_days_checksum << endl;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && string_view(argv[1]) == "--benchmark") {
+    BenchmarkDateParsing();
+    BenchmarkSegmentTrees();
+    BenchmarkOffline();
+    return 0;
+  }
+  const bool offline = argc > 1 && string_view(argv[1]) == "--offline";
+
   cout.precision(25);
   const auto requests = ReadRequests();
-  const auto responses = ProcessRequests(requests);
+  const auto responses = offline ? ProcessRequestsOffline(requests) : ProcessRequests(requests);
   PrintResponses(responses);
 
   return 0;
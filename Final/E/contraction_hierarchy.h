@@ -0,0 +1,447 @@
+#pragma once
+
+#include "graph.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+  // Contraction hierarchy over a DirectedWeightedGraph.
+  // Vertices are contracted one by one in the order of their edge difference,
+  // adding shortcut edges wherever a shortest path went through the contracted vertex.
+  // A query is a bidirectional Dijkstra that only goes up the hierarchy, so it settles
+  // a few hundred vertices even on large graphs. Routes are unpacked back to original EdgeIds.
+  template <typename Weight>
+  class ContractionHierarchy {
+  private:
+    using Graph = DirectedWeightedGraph<Weight>;
+
+  public:
+    explicit ContractionHierarchy(const Graph& graph);
+
+    // Returns the weight of the shortest route and appends its original edges to `edges` in route order.
+    std::optional<Weight> FindRoute(VertexId from, VertexId to, std::vector<EdgeId>& edges) const;
+
+    size_t GetShortcutCount() const;
+    size_t GetMemoryUsage() const;
+
+  private:
+    static constexpr EdgeId NO_EDGE = std::numeric_limits<EdgeId>::max();
+    // Witness searches give up after settling this many vertices and add the shortcut anyway.
+    // Priorities only need an estimate, so their searches are cut shorter.
+    static constexpr size_t WITNESS_SETTLE_LIMIT = 500;
+    static constexpr size_t PRIORITY_SETTLE_LIMIT = 50;
+
+    struct HierarchyEdge {
+      VertexId from;
+      VertexId to;
+      Weight weight;
+      // Halves of a shortcut, NO_EDGE for the edges of the original graph.
+      EdgeId lhs = NO_EDGE;
+      EdgeId rhs = NO_EDGE;
+    };
+
+    struct Shortcut {
+      EdgeId in_edge;
+      EdgeId out_edge;
+    };
+
+    struct SearchItem {
+      Weight weight;
+      VertexId vertex;
+
+      bool operator>(const SearchItem& other) const {
+        return weight > other.weight;
+      }
+    };
+
+    // Single direction of a search with arrays reused between queries.
+    struct SearchSpace {
+      std::vector<std::optional<Weight>> weights;
+      std::vector<EdgeId> prev_edges;
+      std::vector<VertexId> touched_vertices;
+      std::vector<SearchItem> queue;
+
+      void Resize(size_t vertex_count);
+      bool Relax(VertexId vertex, Weight weight, EdgeId prev_edge);
+      void Reset();
+    };
+
+    std::vector<HierarchyEdge> edges_;
+    std::vector<size_t> rank_;
+
+    // Edges going up the hierarchy in compressed rows: out-edges for the forward search
+    // and in-edges for the backward search.
+    std::vector<size_t> up_offsets_;
+    std::vector<EdgeId> up_edges_;
+    std::vector<size_t> down_offsets_;
+    std::vector<EdgeId> down_edges_;
+
+    mutable SearchSpace forward_;
+    mutable SearchSpace backward_;
+
+    // State used only while contracting.
+    struct ContractionState {
+      std::vector<std::vector<EdgeId>> out_edges;
+      std::vector<std::vector<EdgeId>> in_edges;
+      std::vector<bool> contracted;
+      std::vector<size_t> contracted_neighbours;
+      SearchSpace witness;
+    };
+
+    void Contract(ContractionState& state);
+    std::vector<Shortcut> FindShortcuts(ContractionState& state, VertexId vertex, size_t settle_limit) const;
+    int ComputePriority(ContractionState& state, VertexId vertex) const;
+    void BuildSearchGraph();
+    void SearchStep(SearchSpace& space, const std::vector<size_t>& offsets, const std::vector<EdgeId>& row_edges,
+                    bool is_forward, const SearchSpace& other, std::optional<Weight>& best, VertexId& meeting) const;
+    void UnpackEdge(EdgeId edge_id, std::vector<EdgeId>& edges) const;
+  };
+
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::SearchSpace::Resize(size_t vertex_count) {
+    weights.assign(vertex_count, std::nullopt);
+    prev_edges.assign(vertex_count, NO_EDGE);
+  }
+
+  template <typename Weight>
+  bool ContractionHierarchy<Weight>::SearchSpace::Relax(VertexId vertex, Weight weight, EdgeId prev_edge) {
+    auto& current = weights[vertex];
+    if (!current) {
+      touched_vertices.push_back(vertex);
+    } else if (*current <= weight) {
+      return false;
+    }
+    current = weight;
+    prev_edges[vertex] = prev_edge;
+    queue.push_back({weight, vertex});
+    std::push_heap(std::begin(queue), std::end(queue), std::greater<>());
+    return true;
+  }
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::SearchSpace::Reset() {
+    for (const VertexId vertex : touched_vertices) {
+      weights[vertex].reset();
+      prev_edges[vertex] = NO_EDGE;
+    }
+    touched_vertices.clear();
+    queue.clear();
+  }
+
+  template <typename Weight>
+  ContractionHierarchy<Weight>::ContractionHierarchy(const Graph& graph) : rank_(graph.GetVertexCount()) {
+    const size_t vertex_count = graph.GetVertexCount();
+    ContractionState state;
+    state.out_edges.resize(vertex_count);
+    state.in_edges.resize(vertex_count);
+    state.contracted.assign(vertex_count, false);
+    state.contracted_neighbours.assign(vertex_count, 0);
+    state.witness.Resize(vertex_count);
+
+    edges_.reserve(graph.GetEdgeCount());
+    for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+      const auto& edge = graph.GetEdge(edge_id);
+      assert(edge.weight >= 0);
+      edges_.push_back({edge.from, edge.to, edge.weight});
+      if (edge.from != edge.to) {
+        state.out_edges[edge.from].push_back(edge_id);
+        state.in_edges[edge.to].push_back(edge_id);
+      }
+    }
+
+    Contract(state);
+    BuildSearchGraph();
+    forward_.Resize(vertex_count);
+    backward_.Resize(vertex_count);
+  }
+
+  template <typename Weight>
+  std::vector<typename ContractionHierarchy<Weight>::Shortcut>
+  ContractionHierarchy<Weight>::FindShortcuts(ContractionState& state, VertexId vertex, size_t settle_limit) const {
+    // Only the lightest edge to each remaining neighbour matters.
+    auto lightest_edges = [&](const std::vector<EdgeId>& edge_ids, bool is_out) {
+      std::vector<EdgeId> result;
+      for (const EdgeId edge_id : edge_ids) {
+        const auto& edge = edges_[edge_id];
+        const VertexId neighbour = is_out ? edge.to : edge.from;
+        if (state.contracted[neighbour]) {
+          continue;
+        }
+        auto it = std::find_if(std::begin(result), std::end(result), [&](EdgeId other) {
+          return (is_out ? edges_[other].to : edges_[other].from) == neighbour;
+        });
+        if (it == std::end(result)) {
+          result.push_back(edge_id);
+        } else if (edges_[edge_id].weight < edges_[*it].weight) {
+          *it = edge_id;
+        }
+      }
+      return result;
+    };
+    const std::vector<EdgeId> in_edges = lightest_edges(state.in_edges[vertex], false);
+    const std::vector<EdgeId> out_edges = lightest_edges(state.out_edges[vertex], true);
+
+    std::vector<Shortcut> shortcuts;
+    if (out_edges.empty()) {
+      return shortcuts;
+    }
+    Weight max_out_weight = 0;
+    for (const EdgeId out_edge : out_edges) {
+      max_out_weight = std::max(max_out_weight, edges_[out_edge].weight);
+    }
+
+    SearchSpace& witness = state.witness;
+    for (const EdgeId in_edge : in_edges) {
+      const VertexId source = edges_[in_edge].from;
+      const Weight limit = edges_[in_edge].weight + max_out_weight;
+
+      // Dijkstra from the source over the remaining graph without the contracted vertex.
+      witness.Relax(source, 0, NO_EDGE);
+      size_t settled_count = 0;
+      while (!witness.queue.empty() && settled_count < settle_limit) {
+        std::pop_heap(std::begin(witness.queue), std::end(witness.queue), std::greater<>());
+        const SearchItem item = witness.queue.back();
+        witness.queue.pop_back();
+        if (item.weight > *witness.weights[item.vertex]) {
+          continue;
+        }
+        if (item.weight > limit) {
+          break;
+        }
+        ++settled_count;
+        for (const EdgeId edge_id : state.out_edges[item.vertex]) {
+          const auto& edge = edges_[edge_id];
+          if (edge.to != vertex && !state.contracted[edge.to]) {
+            witness.Relax(edge.to, item.weight + edge.weight, edge_id);
+          }
+        }
+      }
+
+      for (const EdgeId out_edge : out_edges) {
+        const VertexId target = edges_[out_edge].to;
+        if (target == source) {
+          continue;
+        }
+        const Weight via_vertex = edges_[in_edge].weight + edges_[out_edge].weight;
+        const auto& witness_weight = witness.weights[target];
+        if (!witness_weight || *witness_weight > via_vertex) {
+          shortcuts.push_back({in_edge, out_edge});
+        }
+      }
+      witness.Reset();
+    }
+    return shortcuts;
+  }
+
+  template <typename Weight>
+  int ContractionHierarchy<Weight>::ComputePriority(ContractionState& state, VertexId vertex) const {
+    size_t removed_edge_count = 0;
+    for (const EdgeId edge_id : state.in_edges[vertex]) {
+      removed_edge_count += !state.contracted[edges_[edge_id].from];
+    }
+    for (const EdgeId edge_id : state.out_edges[vertex]) {
+      removed_edge_count += !state.contracted[edges_[edge_id].to];
+    }
+    const size_t shortcut_count = FindShortcuts(state, vertex, PRIORITY_SETTLE_LIMIT).size();
+    return static_cast<int>(shortcut_count) - static_cast<int>(removed_edge_count)
+        + static_cast<int>(state.contracted_neighbours[vertex]);
+  }
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::Contract(ContractionState& state) {
+    const size_t vertex_count = rank_.size();
+    using QueueItem = std::pair<int, VertexId>;
+    std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+    for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+      queue.push({ComputePriority(state, vertex), vertex});
+    }
+
+    size_t next_rank = 0;
+    while (!queue.empty()) {
+      const VertexId vertex = queue.top().second;
+      queue.pop();
+      if (state.contracted[vertex]) {
+        continue;
+      }
+      // Lazy update: priorities only grow as neighbours get contracted.
+      const int priority = ComputePriority(state, vertex);
+      if (!queue.empty() && priority > queue.top().first) {
+        queue.push({priority, vertex});
+        continue;
+      }
+
+      for (const Shortcut& shortcut : FindShortcuts(state, vertex, WITNESS_SETTLE_LIMIT)) {
+        const auto& in_edge = edges_[shortcut.in_edge];
+        const auto& out_edge = edges_[shortcut.out_edge];
+        const EdgeId shortcut_id = edges_.size();
+        edges_.push_back({in_edge.from, out_edge.to, in_edge.weight + out_edge.weight, shortcut.in_edge, shortcut.out_edge});
+        state.out_edges[edges_.back().from].push_back(shortcut_id);
+        state.in_edges[edges_.back().to].push_back(shortcut_id);
+      }
+
+      state.contracted[vertex] = true;
+      rank_[vertex] = next_rank++;
+      // Drop the edges to the contracted vertex, so that later searches don't scan them.
+      auto is_contracted_edge = [&](EdgeId edge_id) {
+        return state.contracted[edges_[edge_id].from] || state.contracted[edges_[edge_id].to];
+      };
+      for (const EdgeId edge_id : state.in_edges[vertex]) {
+        const VertexId neighbour = edges_[edge_id].from;
+        ++state.contracted_neighbours[neighbour];
+        auto& out_edges = state.out_edges[neighbour];
+        out_edges.erase(std::remove_if(std::begin(out_edges), std::end(out_edges), is_contracted_edge), std::end(out_edges));
+      }
+      for (const EdgeId edge_id : state.out_edges[vertex]) {
+        const VertexId neighbour = edges_[edge_id].to;
+        ++state.contracted_neighbours[neighbour];
+        auto& in_edges = state.in_edges[neighbour];
+        in_edges.erase(std::remove_if(std::begin(in_edges), std::end(in_edges), is_contracted_edge), std::end(in_edges));
+      }
+      state.in_edges[vertex].clear();
+      state.out_edges[vertex].clear();
+    }
+  }
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::BuildSearchGraph() {
+    const size_t vertex_count = rank_.size();
+    up_offsets_.assign(vertex_count + 1, 0);
+    down_offsets_.assign(vertex_count + 1, 0);
+    for (const auto& edge : edges_) {
+      if (edge.from == edge.to) {
+        continue;
+      }
+      if (rank_[edge.from] < rank_[edge.to]) {
+        ++up_offsets_[edge.from + 1];
+      } else {
+        ++down_offsets_[edge.to + 1];
+      }
+    }
+    for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+      up_offsets_[vertex + 1] += up_offsets_[vertex];
+      down_offsets_[vertex + 1] += down_offsets_[vertex];
+    }
+
+    up_edges_.resize(up_offsets_.back());
+    down_edges_.resize(down_offsets_.back());
+    std::vector<size_t> up_positions(std::begin(up_offsets_), std::end(up_offsets_) - 1);
+    std::vector<size_t> down_positions(std::begin(down_offsets_), std::end(down_offsets_) - 1);
+    for (EdgeId edge_id = 0; edge_id < edges_.size(); ++edge_id) {
+      const auto& edge = edges_[edge_id];
+      if (edge.from == edge.to) {
+        continue;
+      }
+      if (rank_[edge.from] < rank_[edge.to]) {
+        up_edges_[up_positions[edge.from]++] = edge_id;
+      } else {
+        down_edges_[down_positions[edge.to]++] = edge_id;
+      }
+    }
+  }
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::SearchStep(SearchSpace& space, const std::vector<size_t>& offsets,
+                                                const std::vector<EdgeId>& row_edges, bool is_forward,
+                                                const SearchSpace& other, std::optional<Weight>& best,
+                                                VertexId& meeting) const {
+    std::pop_heap(std::begin(space.queue), std::end(space.queue), std::greater<>());
+    const SearchItem item = space.queue.back();
+    space.queue.pop_back();
+    if (item.weight > *space.weights[item.vertex]) {
+      return;
+    }
+    if (const auto& other_weight = other.weights[item.vertex]) {
+      if (!best || item.weight + *other_weight < *best) {
+        best = item.weight + *other_weight;
+        meeting = item.vertex;
+      }
+    }
+    for (size_t i = offsets[item.vertex]; i < offsets[item.vertex + 1]; ++i) {
+      const EdgeId edge_id = row_edges[i];
+      const auto& edge = edges_[edge_id];
+      space.Relax(is_forward ? edge.to : edge.from, item.weight + edge.weight, edge_id);
+    }
+  }
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::UnpackEdge(EdgeId edge_id, std::vector<EdgeId>& edges) const {
+    std::vector<EdgeId> stack = {edge_id};
+    while (!stack.empty()) {
+      const EdgeId current = stack.back();
+      stack.pop_back();
+      const auto& edge = edges_[current];
+      if (edge.lhs == NO_EDGE) {
+        edges.push_back(current);
+      } else {
+        stack.push_back(edge.rhs);
+        stack.push_back(edge.lhs);
+      }
+    }
+  }
+
+  template <typename Weight>
+  std::optional<Weight> ContractionHierarchy<Weight>::FindRoute(VertexId from, VertexId to, std::vector<EdgeId>& edges) const {
+    std::optional<Weight> best;
+    VertexId meeting = from;
+    forward_.Relax(from, 0, NO_EDGE);
+    backward_.Relax(to, 0, NO_EDGE);
+
+    // A direction is done once its closest unsettled vertex cannot improve the best route.
+    auto is_active = [&best](const SearchSpace& space) {
+      return !space.queue.empty() && (!best || space.queue.front().weight < *best);
+    };
+    while (is_active(forward_) || is_active(backward_)) {
+      if (is_active(forward_)) {
+        SearchStep(forward_, up_offsets_, up_edges_, true, backward_, best, meeting);
+      }
+      if (is_active(backward_)) {
+        SearchStep(backward_, down_offsets_, down_edges_, false, forward_, best, meeting);
+      }
+    }
+
+    if (best) {
+      std::vector<EdgeId> forward_edges;
+      for (VertexId vertex = meeting; forward_.prev_edges[vertex] != NO_EDGE; vertex = edges_[forward_.prev_edges[vertex]].from) {
+        forward_edges.push_back(forward_.prev_edges[vertex]);
+      }
+      for (auto it = std::rbegin(forward_edges); it != std::rend(forward_edges); ++it) {
+        UnpackEdge(*it, edges);
+      }
+      for (VertexId vertex = meeting; backward_.prev_edges[vertex] != NO_EDGE; vertex = edges_[backward_.prev_edges[vertex]].to) {
+        UnpackEdge(backward_.prev_edges[vertex], edges);
+      }
+    }
+
+    forward_.Reset();
+    backward_.Reset();
+    return best;
+  }
+
+  template <typename Weight>
+  size_t ContractionHierarchy<Weight>::GetShortcutCount() const {
+    size_t count = 0;
+    for (const auto& edge : edges_) {
+      count += edge.lhs != NO_EDGE;
+    }
+    return count;
+  }
+
+  template <typename Weight>
+  size_t ContractionHierarchy<Weight>::GetMemoryUsage() const {
+    return edges_.capacity() * sizeof(HierarchyEdge)
+        + rank_.capacity() * sizeof(size_t)
+        + (up_offsets_.capacity() + down_offsets_.capacity()) * sizeof(size_t)
+        + (up_edges_.capacity() + down_edges_.capacity()) * sizeof(EdgeId)
+        + 2 * rank_.size() * (sizeof(std::optional<Weight>) + sizeof(EdgeId));
+  }
+
+}
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cassert>
+#include <cstddef>
 #include <cstdlib>
 #include <deque>
+#include <iterator>
 #include <vector>
 
 template <typename It>
@@ -30,16 +33,54 @@ namespace Graph {
     Weight weight;
   };
 
+  // Edge ids of a vertex: taken from its incidence list, or consecutive ones in a frozen graph
+  class IncidentEdgeIterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = EdgeId;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const EdgeId*;
+    using reference = EdgeId;
+
+    IncidentEdgeIterator(const EdgeId* listed_id) : listed_id_(listed_id), id_(0) {}
+    explicit IncidentEdgeIterator(EdgeId id) : listed_id_(nullptr), id_(id) {}
+
+    EdgeId operator*() const { return listed_id_ ? *listed_id_ : id_; }
+    IncidentEdgeIterator& operator++() {
+      if (listed_id_) {
+        ++listed_id_;
+      } else {
+        ++id_;
+      }
+      return *this;
+    }
+    bool operator==(const IncidentEdgeIterator& other) const {
+      return listed_id_ == other.listed_id_ && id_ == other.id_;
+    }
+    bool operator!=(const IncidentEdgeIterator& other) const { return !(*this == other); }
+
+  private:
+    const EdgeId* listed_id_;
+    EdgeId id_;
+  };
+
   template <typename Weight>
   class DirectedWeightedGraph {
   private:
     using IncidenceList = std::vector<EdgeId>;
-    using IncidentEdgesRange = Range<typename IncidenceList::const_iterator>;
+    using IncidentEdgesRange = Range<IncidentEdgeIterator>;
 
   public:
     DirectedWeightedGraph(size_t vertex_count);
     EdgeId AddEdge(const Edge<Weight>& edge);
 
+    // Converts the graph to compressed sparse rows: edges sorted by source vertex,
+    // so the edges of a vertex are contiguous and GetIncidentEdges needs no lists.
+    // Edge ids change, the result maps every old id to the new one.
+    // No edges can be added afterwards.
+    std::vector<EdgeId> Freeze();
+    bool IsFrozen() const;
+
     size_t GetVertexCount() const;
     size_t GetEdgeCount() const;
     const Edge<Weight>& GetEdge(EdgeId edge_id) const;
@@ -48,6 +89,8 @@ namespace Graph {
   private:
     std::vector<Edge<Weight>> edges_;
     std::vector<IncidenceList> incidence_lists_;
+    // Edges of vertex v are [first_edges_[v], first_edges_[v + 1]) once frozen, empty before
+    std::vector<EdgeId> first_edges_;
   };
 
 
@@ -56,15 +99,44 @@ namespace Graph {
 
   template <typename Weight>
   EdgeId DirectedWeightedGraph<Weight>::AddEdge(const Edge<Weight>& edge) {
+    assert(!IsFrozen());
     edges_.push_back(edge);
     const EdgeId id = edges_.size() - 1;
     incidence_lists_[edge.from].push_back(id);
     return id;
   }
 
+  template <typename Weight>
+  std::vector<EdgeId> DirectedWeightedGraph<Weight>::Freeze() {
+    assert(!IsFrozen());
+    const size_t vertex_count = incidence_lists_.size();
+    std::vector<EdgeId> new_ids(edges_.size());
+    std::vector<Edge<Weight>> sorted_edges;
+    sorted_edges.reserve(edges_.size());
+    first_edges_.reserve(vertex_count + 1);
+    // Incidence lists already hold the edges of every vertex in order
+    for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+      first_edges_.push_back(sorted_edges.size());
+      for (const EdgeId edge_id : incidence_lists_[vertex]) {
+        new_ids[edge_id] = sorted_edges.size();
+        sorted_edges.push_back(edges_[edge_id]);
+      }
+    }
+    first_edges_.push_back(sorted_edges.size());
+    edges_ = std::move(sorted_edges);
+    incidence_lists_.clear();
+    incidence_lists_.shrink_to_fit();
+    return new_ids;
+  }
+
+  template <typename Weight>
+  bool DirectedWeightedGraph<Weight>::IsFrozen() const {
+    return !first_edges_.empty();
+  }
+
   template <typename Weight>
   size_t DirectedWeightedGraph<Weight>::GetVertexCount() const {
-    return incidence_lists_.size();
+    return IsFrozen() ? first_edges_.size() - 1 : incidence_lists_.size();
   }
 
   template <typename Weight>
@@ -80,7 +152,10 @@ namespace Graph {
   template <typename Weight>
   typename DirectedWeightedGraph<Weight>::IncidentEdgesRange
   DirectedWeightedGraph<Weight>::GetIncidentEdges(VertexId vertex) const {
+    if (IsFrozen()) {
+      return {IncidentEdgeIterator(first_edges_[vertex]), IncidentEdgeIterator(first_edges_[vertex + 1])};
+    }
     const auto& edges = incidence_lists_[vertex];
-    return {std::begin(edges), std::end(edges)};
+    return {IncidentEdgeIterator(edges.data()), IncidentEdgeIterator(edges.data() + edges.size())};
   }
 }
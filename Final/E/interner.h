@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Assigns dense ids to names in the order they are first seen.
+// Every name is stored once and never moves, so GetName references stay valid.
+class Interner {
+public:
+    using Id = uint32_t;
+
+    Id Intern(std::string_view name) {
+        if (auto it = ids.find(name); it != ids.end()) {
+            return it->second;
+        }
+        const Id id = static_cast<Id>(names.size());
+        const std::string& stored_name = names.emplace_back(name);
+        ids.emplace(stored_name, id);
+        return id;
+    }
+
+    std::optional<Id> Find(std::string_view name) const {
+        if (auto it = ids.find(name); it != ids.end()) {
+            return it->second;
+        }
+        return std::nullopt;
+    }
+
+    const std::string& GetName(Id id) const {
+        return names[id];
+    }
+
+    size_t GetSize() const {
+        return names.size();
+    }
+
+private:
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, Id> ids;
+};
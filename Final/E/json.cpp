@@ -1,10 +1,39 @@
 #include "json.h"
-#include <iomanip>
+#include "json_reader.h"
+
+#include <fstream>
+#include <stdexcept>
 
 using namespace std;
 
 namespace Json {
 
+  shared_ptr<Source> Source::FromStream(istream& input) {
+    auto source = make_shared<Source>();
+    source->text = ReadWholeInput(input);
+    return source;
+  }
+
+  shared_ptr<Source> Source::FromFile(const string& path) {
+    auto source = make_shared<Source>();
+    if (!source->mapped_file.Open(path)) {
+      ifstream input(path, ios::binary);
+      if (!input) {
+        throw invalid_argument("can't open " + path);
+      }
+      source->text = ReadWholeInput(input);
+    }
+    return source;
+  }
+
+  shared_ptr<Source> Source::FromStdin() {
+    auto source = make_shared<Source>();
+    if (!source->mapped_file.OpenDescriptor(0)) {
+      source->text = ReadWholeInput(cin);
+    }
+    return source;
+  }
+
   Node LoadNode(istream& input);
 
   Node LoadArray(istream& input) {
@@ -97,4 +126,12 @@ namespace Json {
     return Document{LoadNode(input)};
   }
 
+  DocumentView LoadFile(const string& path) {
+    const auto source = Source::FromFile(path);
+    Reader reader(source->GetText());
+    DocumentView document(reader.ReadNodeView(), source);
+    source->KeepStrings(reader.ReleaseKeptStrings());
+    return document;
+  }
+
 }
@@ -1,44 +1,98 @@
 #pragma once
 
+#include <cstddef>
+#include <deque>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <variant>
 #include <vector>
 #include <sstream>
 
-namespace Json {
+#include "mapped_file.h"
 
-  class Node;
-  using Dict = std::map<std::string, Node>;
+namespace Json {
 
-  class Node : std::variant<std::vector<Node>, Dict, bool, int, double, std::string> {
+  // String is std::string for Nodes that own their strings and std::string_view for NodeViews
+  template <typename String>
+  class BasicNode : std::variant<std::vector<BasicNode<String>>, std::map<String, BasicNode<String>>, bool, int, double, String> {
   public:
-    using variant::variant;
-    const variant& GetBase() const { return *this; }
+    using StringType = String;
+    using Dict = std::map<String, BasicNode>;
 
-    const auto& AsArray() const { return std::get<std::vector<Node>>(*this); }
+    using BasicNode::variant::variant;
+    BasicNode(const char* str) : BasicNode::variant(String(str)) {}
+    // A NodeView of a temporary string would dangle, so it doesn't compile
+    // (a Node just can't be built from nullptr)
+    BasicNode(std::conditional_t<std::is_same_v<String, std::string_view>, std::string&&, std::nullptr_t>) = delete;
+    const typename BasicNode::variant& GetBase() const { return *this; }
+
+    const auto& AsArray() const { return std::get<std::vector<BasicNode>>(*this); }
     const auto& AsMap() const { return std::get<Dict>(*this); }
     bool AsBool() const { return std::get<bool>(*this); }
     int AsInt() const { return std::get<int>(*this); }
-    double AsDouble() const { 
+    double AsDouble() const {
         return std::holds_alternative<double>(*this) ? std::get<double>(*this) : std::get<int>(*this);
     }
-    const auto& AsString() const { return std::get<std::string>(*this); }
+    const auto& AsString() const { return std::get<String>(*this); }
   };
 
-  class Document {
+  using Node = BasicNode<std::string>;
+  using Dict = Node::Dict;
+
+  // Keys and strings are views into the Source of the DocumentView they came from
+  // (or into static strings for NodeViews built by hand), nothing is copied while parsing.
+  using NodeView = BasicNode<std::string_view>;
+  using DictView = NodeView::Dict;
+
+  // Text of a document, memory-mapped or read into memory,
+  // plus the strings that had to be unescaped.
+  class Source {
   public:
-    explicit Document(Node root) : root(std::move(root)) {}
+    static std::shared_ptr<Source> FromStream(std::istream& input);
+    // Memory-maps the file, reads it when it can't be mapped.
+    static std::shared_ptr<Source> FromFile(const std::string& path);
+    // Memory-maps stdin when it is redirected from a file.
+    static std::shared_ptr<Source> FromStdin();
+
+    std::string_view GetText() const {
+      return mapped_file.IsOpen() ? mapped_file.GetView() : std::string_view(text);
+    }
 
-    const Node& GetRoot() const {
+    void KeepStrings(std::deque<std::string> strings) {
+      decoded_strings = std::move(strings);
+    }
+
+  private:
+    std::string text;
+    MappedFile mapped_file;
+    std::deque<std::string> decoded_strings;
+  };
+
+  template <typename NodeType>
+  class BasicDocument {
+  public:
+    explicit BasicDocument(NodeType root, std::shared_ptr<const Source> source = nullptr)
+        : source(std::move(source)), root(std::move(root)) {}
+
+    const NodeType& GetRoot() const {
       return root;
     }
 
   private:
-    Node root;
+    std::shared_ptr<const Source> source;
+    NodeType root;
   };
 
+  using Document = BasicDocument<Node>;
+  // Keeps alive the Source its NodeViews point into
+  using DocumentView = BasicDocument<NodeView>;
+
   Document Load(std::istream& input = std::cin);
+  // Zero-copy loader: the NodeViews point straight into the mapped file.
+  DocumentView LoadFile(const std::string& path);
 
 }
@@ -0,0 +1,292 @@
+#include "json_reader.h"
+
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+using namespace std;
+
+namespace Json {
+
+  char Reader::PeekToken() {
+    while (pos < input.size() && isspace(static_cast<unsigned char>(input[pos]))) {
+      ++pos;
+    }
+    if (pos == input.size()) {
+      ThrowError("unexpected end of input");
+    }
+    return input[pos];
+  }
+
+  void Reader::Expect(char c) {
+    if (PeekToken() != c) {
+      ThrowError(string("expected '") + c + "'");
+    }
+    ++pos;
+  }
+
+  void Reader::ThrowError(const string& message) const {
+    throw invalid_argument("JSON: " + message + " at position " + to_string(pos));
+  }
+
+  void Reader::BeginObject() {
+    Expect('{');
+  }
+
+  bool Reader::NextItemInObject() {
+    char c = PeekToken();
+    if (c == ',') {
+      ++pos;
+      c = PeekToken();
+    }
+    if (c == '}') {
+      ++pos;
+      return false;
+    }
+    return true;
+  }
+
+  bool Reader::NextKey(string_view& key) {
+    if (!NextItemInObject()) {
+      return false;
+    }
+    key = ReadString();
+    Expect(':');
+    return true;
+  }
+
+  void Reader::BeginArray() {
+    Expect('[');
+  }
+
+  bool Reader::NextItem() {
+    char c = PeekToken();
+    if (c == ',') {
+      ++pos;
+      c = PeekToken();
+    }
+    if (c == ']') {
+      ++pos;
+      return false;
+    }
+    return true;
+  }
+
+  static void AppendUtf8(string& out, uint32_t code_point) {
+    if (code_point < 0x80) {
+      out.push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+      out.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+      out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else if (code_point < 0x10000) {
+      out.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+      out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+      out.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+      out.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+  }
+
+  string_view Reader::ReadString() {
+    Expect('"');
+    const size_t begin = pos;
+    const size_t end = input.find_first_of("\"\\", begin);
+    if (end == string_view::npos) {
+      ThrowError("unterminated string");
+    }
+    if (input[end] == '"') {
+      pos = end + 1;
+      return input.substr(begin, end - begin);
+    }
+
+    // Slow path: the string has escapes
+    unescaped.assign(input.substr(begin, end - begin));
+    pos = end;
+    auto read_hex4 = [this] {
+      uint32_t value = 0;
+      if (pos + 4 > input.size() || from_chars(input.data() + pos, input.data() + pos + 4, value, 16).ptr != input.data() + pos + 4) {
+        ThrowError("bad \\u escape");
+      }
+      pos += 4;
+      return value;
+    };
+    while (pos < input.size() && input[pos] != '"') {
+      const char c = input[pos++];
+      if (c != '\\') {
+        unescaped.push_back(c);
+        continue;
+      }
+      if (pos == input.size()) {
+        break;
+      }
+      switch (const char escaped = input[pos++]) {
+        case 'n': unescaped.push_back('\n'); break;
+        case 't': unescaped.push_back('\t'); break;
+        case 'r': unescaped.push_back('\r'); break;
+        case 'b': unescaped.push_back('\b'); break;
+        case 'f': unescaped.push_back('\f'); break;
+        case 'u': {
+          uint32_t code_point = read_hex4();
+          // Surrogate pair
+          if (code_point >= 0xD800 && code_point < 0xDC00 && input.substr(pos, 2) == "\\u") {
+            pos += 2;
+            code_point = 0x10000 + ((code_point - 0xD800) << 10) + (read_hex4() - 0xDC00);
+          }
+          AppendUtf8(unescaped, code_point);
+          break;
+        }
+        default:
+          // \" \\ \/
+          unescaped.push_back(escaped);
+      }
+    }
+    if (pos == input.size()) {
+      ThrowError("unterminated string");
+    }
+    ++pos;
+    return unescaped;
+  }
+
+  string_view Reader::ReadNumberToken() {
+    PeekToken();
+    const size_t begin = pos;
+    while (pos < input.size() && (isdigit(static_cast<unsigned char>(input[pos]))
+           || input[pos] == '-' || input[pos] == '+' || input[pos] == '.' || input[pos] == 'e' || input[pos] == 'E')) {
+      ++pos;
+    }
+    if (begin == pos) {
+      ThrowError("expected a number");
+    }
+    return input.substr(begin, pos - begin);
+  }
+
+  int Reader::ReadInt() {
+    const string_view token = ReadNumberToken();
+    int result = 0;
+    const auto [ptr, ec] = from_chars(token.data(), token.data() + token.size(), result);
+    if (ec != errc() || ptr != token.data() + token.size()) {
+      ThrowError("bad integer " + string(token));
+    }
+    return result;
+  }
+
+  double Reader::ReadDouble() {
+    const string_view token = ReadNumberToken();
+    double result = 0.;
+    const auto [ptr, ec] = from_chars(token.data(), token.data() + token.size(), result);
+    if (ec != errc() || ptr != token.data() + token.size()) {
+      ThrowError("bad number " + string(token));
+    }
+    return result;
+  }
+
+  bool Reader::ReadBool() {
+    PeekToken();
+    if (input.substr(pos, 4) == "true") {
+      pos += 4;
+      return true;
+    }
+    if (input.substr(pos, 5) == "false") {
+      pos += 5;
+      return false;
+    }
+    ThrowError("expected a bool");
+  }
+
+  void Reader::SkipValue() {
+    const char c = PeekToken();
+    if (c == '{') {
+      BeginObject();
+      for (string_view key; NextKey(key); ) {
+        SkipValue();
+      }
+    } else if (c == '[') {
+      BeginArray();
+      while (NextItem()) {
+        SkipValue();
+      }
+    } else if (c == '"') {
+      ReadString();
+    } else if (c == 't' || c == 'f') {
+      ReadBool();
+    } else {
+      ReadNumberToken();
+    }
+  }
+
+  string_view Reader::ReadKeptString() {
+    const string_view str = ReadString();
+    if (str.data() == unescaped.data()) {
+      return kept_strings.emplace_back(unescaped);
+    }
+    return str;
+  }
+
+  template <typename NodeType>
+  NodeType Reader::ReadNodeOf() {
+    using String = typename NodeType::StringType;
+    // Owned strings are copied right away, before the next escaped string overwrites them
+    auto read_string = [this]() -> String {
+      if constexpr (is_same_v<String, string_view>) {
+        return ReadKeptString();
+      } else {
+        return String(ReadString());
+      }
+    };
+
+    const char c = PeekToken();
+    if (c == '{') {
+      typename NodeType::Dict result;
+      BeginObject();
+      while (NextItemInObject()) {
+        String key = read_string();
+        Expect(':');
+        result.emplace(move(key), ReadNodeOf<NodeType>());
+      }
+      return NodeType(move(result));
+    } else if (c == '[') {
+      vector<NodeType> result;
+      BeginArray();
+      while (NextItem()) {
+        result.push_back(ReadNodeOf<NodeType>());
+      }
+      return NodeType(move(result));
+    } else if (c == '"') {
+      return NodeType(read_string());
+    } else if (c == 't' || c == 'f') {
+      return NodeType(ReadBool());
+    }
+
+    const size_t begin = pos;
+    const string_view token = ReadNumberToken();
+    if (token.find_first_of(".eE") == string_view::npos) {
+      pos = begin;
+      return NodeType(ReadInt());
+    }
+    pos = begin;
+    return NodeType(ReadDouble());
+  }
+
+  Node Reader::ReadNode() {
+    return ReadNodeOf<Node>();
+  }
+
+  NodeView Reader::ReadNodeView() {
+    return ReadNodeOf<NodeView>();
+  }
+
+  string ReadWholeInput(istream& input) {
+    string result;
+    char buffer[1 << 16];
+    while (input.read(buffer, sizeof(buffer)) || input.gcount() > 0) {
+      result.append(buffer, input.gcount());
+    }
+    return result;
+  }
+
+}
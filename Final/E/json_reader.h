@@ -0,0 +1,79 @@
+#pragma once
+
+#include <deque>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "json.h"
+
+namespace Json {
+
+  // Pull parser over a whole JSON document held in memory.
+  // Callers walk the document value by value instead of getting a tree of Nodes:
+  //
+  //   reader.BeginObject();
+  //   for (std::string_view key; reader.NextKey(key); ) {
+  //     if (key == "name") name = reader.ReadString(); else reader.SkipValue();
+  //   }
+  //
+  // Strings without escapes are views into the input. Escaped ones are decoded
+  // into an internal buffer and stay valid only until the next string is read.
+  class Reader {
+  public:
+    explicit Reader(std::string_view input) : input(input) {}
+
+    void BeginObject();
+    // Reads the next key of the current object and the colon after it.
+    // Returns false and consumes the closing brace when the object is over.
+    bool NextKey(std::string_view& key);
+
+    void BeginArray();
+    // Returns false and consumes the closing bracket when the array is over.
+    bool NextItem();
+
+    std::string_view ReadString();
+    int ReadInt();
+    double ReadDouble();
+    bool ReadBool();
+    void SkipValue();
+
+    // Builds a Node for the next value only, for the parts that are easier to handle as a tree.
+    Node ReadNode();
+    // The same without copying strings: they point into the input,
+    // unescaped ones into strings kept by the reader.
+    NodeView ReadNodeView();
+
+    // Hands over the unescaped strings of the NodeViews read so far, to outlive the reader.
+    std::deque<std::string> ReleaseKeptStrings() {
+      return std::move(kept_strings);
+    }
+
+    size_t GetPosition() const {
+      return pos;
+    }
+
+    void SetPosition(size_t position) {
+      pos = position;
+    }
+
+  private:
+    std::string_view input;
+    size_t pos = 0;
+    std::string unescaped;
+    std::deque<std::string> kept_strings;
+
+    std::string_view ReadKeptString();
+    template <typename NodeType>
+    NodeType ReadNodeOf();
+
+    char PeekToken();
+    bool NextItemInObject();
+    void Expect(char c);
+    std::string_view ReadNumberToken();
+    [[noreturn]] void ThrowError(const std::string& message) const;
+  };
+
+  std::string ReadWholeInput(std::istream& input = std::cin);
+
+}
@@ -0,0 +1,212 @@
+#include "json_writer.h"
+
+#include <charconv>
+#include <limits>
+
+using namespace std;
+
+namespace Json {
+
+  Writer::Writer(ostream& output, size_t flush_threshold)
+      : output(&output), flush_threshold(flush_threshold) {
+    buffer.reserve(flush_threshold + 1024);
+  }
+
+  Writer::Writer(vector<bool> is_empty_scope)
+      : output(nullptr), flush_threshold(numeric_limits<size_t>::max()), is_empty_scope(move(is_empty_scope)) {}
+
+  Writer::~Writer() {
+    Flush();
+  }
+
+  void Writer::Flush() {
+    if (output) {
+      output->write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  }
+
+  Writer Writer::MakeItemsWriter() const {
+    // Same depth, so that the items are indented as if they were written here
+    return Writer(vector<bool>(is_empty_scope.size(), true));
+  }
+
+  Writer& Writer::AppendItems(Writer&& items_writer) {
+    if (!items_writer.buffer.empty()) {
+      if (!is_empty_scope.back()) {
+        buffer.push_back(',');
+      }
+      is_empty_scope.back() = false;
+      if (output) {
+        // Parts are usually large, no point in copying them into the buffer
+        Flush();
+        output->write(items_writer.buffer.data(), items_writer.buffer.size());
+      } else {
+        buffer += items_writer.buffer;
+      }
+      items_writer.buffer.clear();
+    }
+    return *this;
+  }
+
+  void Writer::WriteIndent() {
+    buffer.push_back('\n');
+    buffer.append(2 * is_empty_scope.size(), ' ');
+  }
+
+  void Writer::BeginItem() {
+    if (after_key) {
+      after_key = false;
+      return;
+    }
+    if (!is_empty_scope.empty()) {
+      if (!is_empty_scope.back()) {
+        buffer.push_back(',');
+      }
+      is_empty_scope.back() = false;
+      WriteIndent();
+    }
+  }
+
+  void Writer::EndScope(char bracket) {
+    const bool is_empty = is_empty_scope.back();
+    is_empty_scope.pop_back();
+    if (!is_empty) {
+      WriteIndent();
+    }
+    buffer.push_back(bracket);
+    if (is_empty_scope.empty() || buffer.size() >= flush_threshold) {
+      Flush();
+    }
+  }
+
+  Writer& Writer::BeginObject() {
+    BeginItem();
+    buffer.push_back('{');
+    is_empty_scope.push_back(true);
+    return *this;
+  }
+
+  Writer& Writer::EndObject() {
+    EndScope('}');
+    return *this;
+  }
+
+  Writer& Writer::BeginArray() {
+    BeginItem();
+    buffer.push_back('[');
+    is_empty_scope.push_back(true);
+    return *this;
+  }
+
+  Writer& Writer::EndArray() {
+    EndScope(']');
+    return *this;
+  }
+
+  Writer& Writer::Key(string_view key) {
+    BeginItem();
+    WriteString(key);
+    buffer.append(": ");
+    after_key = true;
+    return *this;
+  }
+
+  void Writer::WriteString(string_view str) {
+    buffer.push_back('"');
+    for (const char c : str) {
+      switch (c) {
+        case '"': buffer.append("\\\""); break;
+        case '\\': buffer.append("\\\\"); break;
+        case '\n': buffer.append("\\n"); break;
+        case '\r': buffer.append("\\r"); break;
+        case '\t': buffer.append("\\t"); break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20) {
+            static const char HEX[] = "0123456789abcdef";
+            buffer.append("\\u00");
+            buffer.push_back(HEX[c >> 4]);
+            buffer.push_back(HEX[c & 0xF]);
+          } else {
+            buffer.push_back(c);
+          }
+      }
+    }
+    buffer.push_back('"');
+  }
+
+  template <typename Number>
+  void Writer::WriteNumber(Number value) {
+    char digits[32];
+    const auto result = to_chars(begin(digits), end(digits), value);
+    buffer.append(digits, result.ptr);
+  }
+
+  Writer& Writer::Value(string_view value) {
+    BeginItem();
+    WriteString(value);
+    return *this;
+  }
+
+  Writer& Writer::Value(const char* value) {
+    return Value(string_view(value));
+  }
+
+  Writer& Writer::Value(const string& value) {
+    return Value(string_view(value));
+  }
+
+  Writer& Writer::Value(bool value) {
+    BeginItem();
+    buffer.append(value ? "true" : "false");
+    return *this;
+  }
+
+  Writer& Writer::Value(int value) {
+    BeginItem();
+    WriteNumber(value);
+    return *this;
+  }
+
+  Writer& Writer::Value(size_t value) {
+    BeginItem();
+    WriteNumber(value);
+    return *this;
+  }
+
+  Writer& Writer::Value(double value) {
+    // Shortest representation that reads back as the same double
+    BeginItem();
+    WriteNumber(value);
+    return *this;
+  }
+
+  Writer& Writer::Value(const Node& node) {
+    if (const auto* array = get_if<vector<Node>>(&node.GetBase())) {
+      BeginArray();
+      for (const Node& item : *array) {
+        Value(item);
+      }
+      return EndArray();
+    } else if (const auto* dict = get_if<Dict>(&node.GetBase())) {
+      BeginObject();
+      for (const auto& [key, item] : *dict) {
+        Key(key).Value(item);
+      }
+      return EndObject();
+    } else if (const auto* value = get_if<bool>(&node.GetBase())) {
+      return Value(*value);
+    } else if (const auto* value = get_if<int>(&node.GetBase())) {
+      return Value(*value);
+    } else if (const auto* value = get_if<double>(&node.GetBase())) {
+      return Value(*value);
+    }
+    return Value(node.AsString());
+  }
+
+  void Print(const Node& node, ostream& output) {
+    Writer writer(output);
+    writer.Value(node);
+  }
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "json.h"
+
+namespace Json {
+
+  // Streaming JSON writer. Everything is appended to one buffer,
+  // which goes to the output stream in large chunks:
+  //
+  //   writer.BeginObject().Key("request_id").Value(id).EndObject();
+  //
+  // Output is pretty-printed with two-space indents.
+  class Writer {
+  public:
+    explicit Writer(std::ostream& output = std::cout, size_t flush_threshold = 1 << 16);
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+    Writer(Writer&&) = default;
+    ~Writer();
+
+    // Writer for a part of the items of the array open here, e.g. filled on another thread.
+    // It keeps its text in memory until it is handed back with AppendItems.
+    Writer MakeItemsWriter() const;
+    Writer& AppendItems(Writer&& items_writer);
+
+    Writer& BeginObject();
+    Writer& EndObject();
+    Writer& BeginArray();
+    Writer& EndArray();
+    Writer& Key(std::string_view key);
+
+    Writer& Value(std::string_view value);
+    Writer& Value(const char* value);
+    Writer& Value(const std::string& value);
+    Writer& Value(bool value);
+    Writer& Value(int value);
+    Writer& Value(size_t value);
+    Writer& Value(double value);
+    Writer& Value(const Node& node);
+
+    void Flush();
+
+  private:
+    // Null for items writers
+    std::ostream* output;
+    size_t flush_threshold;
+    std::string buffer;
+    // One entry per open object or array: whether it has no items yet.
+    std::vector<bool> is_empty_scope;
+    bool after_key = false;
+
+    explicit Writer(std::vector<bool> is_empty_scope);
+
+    void BeginItem();
+    void EndScope(char bracket);
+    void WriteIndent();
+    void WriteString(std::string_view str);
+    template <typename Number>
+    void WriteNumber(Number value);
+  };
+
+  void Print(const Node& node, std::ostream& output = std::cout);
+
+}
@@ -12,11 +12,14 @@
 #include "requests.h"
 #include "transport_db.h"
 #include "json.h"
+#include "json_reader.h"
+#include "json_writer.h"
 
 // #include "test_string_parses.h"
 // #include "test_requests.h"
 // #include "test_transport_db.h"
 // #include "test_json.h"
+// #include "test_router.h"
 
 using namespace std;
 using namespace Json;
@@ -27,16 +30,31 @@ int main() {
     // TestAllRequests();
     // TestAllTransportDB();
     // TestAllJson();
+    // TestAllRouter();
 
     TransportDatabase db;
 
-    Document input_doc = Load();
-    const auto& input_map = input_doc.GetRoot().AsMap();
-    const auto modify_requests = ReadRequests(input_map.at("base_requests").AsArray(), true);
+    // Memory-mapped when stdin is redirected from a file
+    const auto input = Source::FromStdin();
+    Reader reader(input->GetText());
+    vector<RequestHolder> modify_requests;
+    vector<RequestHolder> read_requests;
+    reader.BeginObject();
+    for (string_view key; reader.NextKey(key); ) {
+        if (key == "base_requests") {
+            modify_requests = ReadRequests(reader, true);
+        } else if (key == "stat_requests") {
+            read_requests = ReadRequests(reader, false);
+        } else if (key == "routing_settings") {
+            db.SetRoutingSettings(RoutingSettings::ParseFrom(reader));
+        } else {
+            reader.SkipValue();
+        }
+    }
+
     ProcessModifyRequests(&db, modify_requests);
-    const auto read_requests = ReadRequests(input_map.at("stat_requests").AsArray(), false);
-    const auto responses = ProcessRequests(db, read_requests);
-    PrintResponses(responses);
+    Writer writer(cout);
+    ProcessRequests(db, read_requests, writer);
 
     
     return 0;
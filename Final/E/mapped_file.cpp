@@ -0,0 +1,84 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAS_MMAP 1
+#endif
+
+using namespace std;
+
+MappedFile::MappedFile(MappedFile&& other)
+    : data(exchange(other.data, nullptr))
+    , size(exchange(other.size, 0))
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) {
+    if (this != &other) {
+        Close();
+        data = exchange(other.data, nullptr);
+        size = exchange(other.size, 0);
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+#ifdef HAS_MMAP
+
+bool MappedFile::Open(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const bool result = OpenDescriptor(fd);
+    close(fd);
+    return result;
+}
+
+bool MappedFile::OpenDescriptor(int fd) {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size == 0) {
+        return false;
+    }
+    void* mapped = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    // The parser reads the text front to back
+    madvise(mapped, file_stat.st_size, MADV_SEQUENTIAL);
+    Close();
+    data = static_cast<const char*>(mapped);
+    size = file_stat.st_size;
+    return true;
+}
+
+void MappedFile::Close() {
+    if (data) {
+        munmap(const_cast<char*>(data), size);
+        data = nullptr;
+        size = 0;
+    }
+}
+
+#else
+
+bool MappedFile::Open(const string&) {
+    return false;
+}
+
+bool MappedFile::OpenDescriptor(int) {
+    return false;
+}
+
+void MappedFile::Close() {
+}
+
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file.
+// Open* return false when the file can't be mapped (a pipe, an empty file,
+// a platform without mmap), so that callers fall back to reading it.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other);
+    MappedFile& operator=(MappedFile&& other);
+    ~MappedFile();
+
+    bool Open(const std::string& path);
+    bool OpenDescriptor(int fd);
+
+    bool IsOpen() const {
+        return data != nullptr;
+    }
+
+    std::string_view GetView() const {
+        return {data, size};
+    }
+
+private:
+    const char* data = nullptr;
+    size_t size = 0;
+
+    void Close();
+};
@@ -3,9 +3,14 @@
 #include <string>
 #include <memory>
 #include <variant>
+#include <algorithm>
+#include <future>
+#include <thread>
 
 #include "transport_db.h"
 #include "json.h"
+#include "json_reader.h"
+#include "json_writer.h"
 
 struct Request;
 using RequestHolder = std::unique_ptr<Request>;
@@ -15,12 +20,19 @@ struct Request {
         ADD_STOP,
         ADD_BUS,
         OUT_BUS,
-        OUT_STOP
+        OUT_STOP,
+        OUT_ROUTE
     };
 
     Request(Type type) : type(type) {}
     static RequestHolder Create(Request::Type type);
     virtual void ParseFrom(const Json::Node& request_node) = 0;
+    virtual void ParseFrom(const Json::NodeView& request_node) = 0;
+    // Parses the request object straight from the reader, without building Nodes.
+    // The "type" key has already been looked at and is skipped.
+    virtual void ParseFrom(Json::Reader& reader) {
+        ParseFrom(reader.ReadNode());
+    }
     virtual ~Request() = default;
 
     const Type type;
@@ -36,10 +48,11 @@ struct AddBusRequest : ModifyRequest {
     AddBusRequest() : ModifyRequest(Type::ADD_BUS) {}
     virtual ~AddBusRequest() = default;
 
-    std::vector<std::string> NodesToStrings(const std::vector<Json::Node>& nodes, bool is_roundtrip) const {
+    template <typename NodeType>
+    std::vector<std::string> NodesToStrings(const std::vector<NodeType>& nodes, bool is_roundtrip) const {
         std::vector<std::string> result;
-        for (const Json::Node& node : nodes) {
-            result.push_back(node.AsString());
+        for (const NodeType& node : nodes) {
+            result.emplace_back(node.AsString());
         }
 
         if (!is_roundtrip) {
@@ -51,12 +64,46 @@ struct AddBusRequest : ModifyRequest {
     }
 
     void ParseFrom(const Json::Node& request_node) override {
+        ParseFromNode(request_node);
+    }
+
+    void ParseFrom(const Json::NodeView& request_node) override {
+        ParseFromNode(request_node);
+    }
+
+    template <typename NodeType>
+    void ParseFromNode(const NodeType& request_node) {
         bus_number = request_node.AsMap().at("name").AsString();
         bool is_roundtrip = request_node.AsMap().at("is_roundtrip").AsBool();
         
         stops = NodesToStrings(request_node.AsMap().at("stops").AsArray(), is_roundtrip);
     }
 
+    void ParseFrom(Json::Reader& reader) override {
+        bool is_roundtrip = false;
+        reader.BeginObject();
+        for (std::string_view key; reader.NextKey(key); ) {
+            if (key == "name") {
+                bus_number = reader.ReadString();
+            } else if (key == "is_roundtrip") {
+                is_roundtrip = reader.ReadBool();
+            } else if (key == "stops") {
+                reader.BeginArray();
+                while (reader.NextItem()) {
+                    stops.emplace_back(reader.ReadString());
+                }
+            } else {
+                reader.SkipValue();
+            }
+        }
+
+        if (!is_roundtrip && !stops.empty()) {
+            for (size_t i = stops.size() - 1; i > 0; --i) {
+                stops.push_back(stops[i - 1]);
+            }
+        }
+    }
+
     void Process(TransportDatabase& db) const override {
         db.AddBus(std::move(bus_number), std::move(stops));
     }
@@ -73,6 +120,14 @@ struct AddStopRequest : ModifyRequest {
         stop = Stop::ParseFrom(request_node);
     }
 
+    void ParseFrom(const Json::NodeView& request_node) override {
+        stop = Stop::ParseFrom(request_node);
+    }
+
+    void ParseFrom(Json::Reader& reader) override {
+        stop = Stop::ParseFrom(reader);
+    }
+
     void Process(TransportDatabase& db) const override {
         // Add stop to db
         db.AddStop(std::move(stop));
@@ -81,49 +136,136 @@ struct AddStopRequest : ModifyRequest {
     Stop stop;
 };
 
-template <typename ResultType>
 struct ReadRequest : Request {
     using Request::Request;
-    virtual ResultType Process(const TransportDatabase& db) const = 0;
+    // Writes the response object straight into the writer
+    virtual void Process(const TransportDatabase& db, Json::Writer& writer) const = 0;
     virtual ~ReadRequest() = default;
 };
 
-struct BusRequest : ReadRequest<std::string> {
+struct BusRequest : ReadRequest {
     BusRequest() : ReadRequest(Type::OUT_BUS) {}
     virtual ~BusRequest() = default;
 
     void ParseFrom(const Json::Node& request_node) override {
+        ParseFromNode(request_node);
+    }
+
+    void ParseFrom(const Json::NodeView& request_node) override {
+        ParseFromNode(request_node);
+    }
+
+    template <typename NodeType>
+    void ParseFromNode(const NodeType& request_node) {
         // input = "X"
         id = request_node.AsMap().at("id").AsInt();
         bus_number = request_node.AsMap().at("name").AsString();
     }
 
-    std::string Process(const TransportDatabase& db) const override {
-        return db.GetBusInfo(bus_number, id);
+    void ParseFrom(Json::Reader& reader) override {
+        reader.BeginObject();
+        for (std::string_view key; reader.NextKey(key); ) {
+            if (key == "id") {
+                id = reader.ReadInt();
+            } else if (key == "name") {
+                bus_number = reader.ReadString();
+            } else {
+                reader.SkipValue();
+            }
+        }
+    }
+
+    void Process(const TransportDatabase& db, Json::Writer& writer) const override {
+        db.WriteBusInfo(bus_number, id, writer);
     }
 
     std::string bus_number;
     int id = 0;
 };
 
-struct StopRequest : ReadRequest<std::string> {
+struct StopRequest : ReadRequest {
     StopRequest() : ReadRequest(Type::OUT_STOP) {}
     virtual ~StopRequest() = default;
 
     void ParseFrom(const Json::Node& request_node) override {
+        ParseFromNode(request_node);
+    }
+
+    void ParseFrom(const Json::NodeView& request_node) override {
+        ParseFromNode(request_node);
+    }
+
+    template <typename NodeType>
+    void ParseFromNode(const NodeType& request_node) {
         // input = "X"
         id = request_node.AsMap().at("id").AsInt();
         stop_name = request_node.AsMap().at("name").AsString();
     }
 
-    std::string Process(const TransportDatabase& db) const override {
-        return db.GetStopInfo(stop_name, id);
+    void ParseFrom(Json::Reader& reader) override {
+        reader.BeginObject();
+        for (std::string_view key; reader.NextKey(key); ) {
+            if (key == "id") {
+                id = reader.ReadInt();
+            } else if (key == "name") {
+                stop_name = reader.ReadString();
+            } else {
+                reader.SkipValue();
+            }
+        }
+    }
+
+    void Process(const TransportDatabase& db, Json::Writer& writer) const override {
+        db.WriteStopInfo(stop_name, id, writer);
     }
 
     std::string stop_name;
     int id = 0;
 };
 
+struct RouteRequest : ReadRequest {
+    RouteRequest() : ReadRequest(Type::OUT_ROUTE) {}
+    virtual ~RouteRequest() = default;
+
+    void ParseFrom(const Json::Node& request_node) override {
+        ParseFromNode(request_node);
+    }
+
+    void ParseFrom(const Json::NodeView& request_node) override {
+        ParseFromNode(request_node);
+    }
+
+    template <typename NodeType>
+    void ParseFromNode(const NodeType& request_node) {
+        id = request_node.AsMap().at("id").AsInt();
+        from = request_node.AsMap().at("from").AsString();
+        to = request_node.AsMap().at("to").AsString();
+    }
+
+    void ParseFrom(Json::Reader& reader) override {
+        reader.BeginObject();
+        for (std::string_view key; reader.NextKey(key); ) {
+            if (key == "id") {
+                id = reader.ReadInt();
+            } else if (key == "from") {
+                from = reader.ReadString();
+            } else if (key == "to") {
+                to = reader.ReadString();
+            } else {
+                reader.SkipValue();
+            }
+        }
+    }
+
+    void Process(const TransportDatabase& db, Json::Writer& writer) const override {
+        db.WriteRouteInfo(from, to, id, writer);
+    }
+
+    std::string from;
+    std::string to;
+    int id = 0;
+};
+
 RequestHolder Request::Create(Request::Type type) {
     switch (type) {
         case Type::ADD_STOP:
@@ -134,6 +276,8 @@ RequestHolder Request::Create(Request::Type type) {
             return std::make_unique<BusRequest>();
         case Type::OUT_STOP:
             return std::make_unique<StopRequest>();
+        case Type::OUT_ROUTE:
+            return std::make_unique<RouteRequest>();
         default:
             return nullptr;
     }
@@ -151,12 +295,15 @@ std::optional<Request::Type> ConvertRequestTypeFromString(std::string_view type_
             return Request::Type::OUT_BUS;
         } else if (type_str == "Stop") {
             return Request::Type::OUT_STOP;
+        } else if (type_str == "Route") {
+            return Request::Type::OUT_ROUTE;
         }
     }
     return std::nullopt;
 }
 
-RequestHolder ParseRequest(const Json::Node& request_node, bool is_add_request) {
+template <typename NodeType>
+RequestHolder ParseRequest(const NodeType& request_node, bool is_add_request) {
     const auto request_type = ConvertRequestTypeFromString(request_node.AsMap().at("type").AsString(), is_add_request);
     if (!request_type) {
         return nullptr;
@@ -169,7 +316,46 @@ RequestHolder ParseRequest(const Json::Node& request_node, bool is_add_request)
     return request;
 }
 
-std::vector<RequestHolder> ReadRequests(const std::vector<Json::Node>& requests, bool is_add_request) {
+RequestHolder ParseRequest(Json::Reader& reader, bool is_add_request) {
+    // Keys may come in any order, so find "type" first and then parse the object again from its start
+    const size_t request_begin = reader.GetPosition();
+    std::optional<std::string_view> type_str;
+    reader.BeginObject();
+    for (std::string_view key; !type_str && reader.NextKey(key); ) {
+        if (key == "type") {
+            type_str = reader.ReadString();
+        } else {
+            reader.SkipValue();
+        }
+    }
+    if (!type_str) {
+        throw std::invalid_argument("request without type");
+    }
+    const auto request_type = ConvertRequestTypeFromString(*type_str, is_add_request);
+    reader.SetPosition(request_begin);
+
+    if (!request_type) {
+        reader.SkipValue();
+        return nullptr;
+    }
+    RequestHolder request = Request::Create(*request_type);
+    request->ParseFrom(reader);
+    return request;
+}
+
+std::vector<RequestHolder> ReadRequests(Json::Reader& reader, bool is_add_request) {
+    std::vector<RequestHolder> updates;
+    reader.BeginArray();
+    while (reader.NextItem()) {
+        if (auto request = ParseRequest(reader, is_add_request)) {
+            updates.push_back(std::move(request));
+        }
+    }
+    return updates;
+}
+
+template <typename NodeType>
+std::vector<RequestHolder> ReadRequests(const std::vector<NodeType>& requests, bool is_add_request) {
     const size_t request_count = requests.size();
     std::vector<RequestHolder> updates;
     updates.reserve(request_count);
@@ -190,65 +376,53 @@ void ProcessModifyRequests(TransportDatabase* db = nullptr, const std::vector<Re
         const auto& request = static_cast<const ModifyRequest&>(*request_holder);
         request.Process(*db);
     }
+    db->Finalize();
 }
 
-std::vector<Json::Node> ProcessRequestsJson(const TransportDatabase& db, const std::vector<RequestHolder>& requests) {
-    std::vector<Json::Node> responses;
-
-    for (const auto& request_holder : requests) {
-        switch(request_holder->type) {
+void ProcessReadRequests(const TransportDatabase& db, const std::vector<RequestHolder>& requests,
+                         size_t begin, size_t end, Json::Writer& writer) {
+    for (size_t i = begin; i < end; ++i) {
+        switch(requests[i]->type) {
             case Request::Type::OUT_BUS:
-            case Request::Type::OUT_STOP: {
-                const auto& request = static_cast<const ReadRequest<Json::Node>&>(*request_holder);
-                responses.push_back(request.Process(db));
+            case Request::Type::OUT_STOP:
+            case Request::Type::OUT_ROUTE: {
+                const auto& request = static_cast<const ReadRequest&>(*requests[i]);
+                request.Process(db, writer);
                 break;
             }
             default:
                 throw std::invalid_argument("Unknown request type");
         }
     }
-
-    return responses;
 }
 
-std::vector<std::string> ProcessRequests(const TransportDatabase& db, const std::vector<RequestHolder>& requests) {
-    std::vector<std::string> responses;
-
-    for (const auto& request_holder : requests) {
-        switch(request_holder->type) {
-            case Request::Type::OUT_BUS:
-            case Request::Type::OUT_STOP: {
-                const auto& request = static_cast<const ReadRequest<std::string>&>(*request_holder);
-                responses.push_back(request.Process(db));
-                break;
-            }
-            default:
-                throw std::invalid_argument("Unknown request type");
+// Below this many requests per thread answering them in parallel is not worth it.
+const size_t MIN_READ_REQUESTS_PER_THREAD = 1024;
+
+// The database must not change while the requests are processed: they are split into
+// contiguous chunks answered concurrently, and the responses are written in the original order.
+void ProcessRequests(const TransportDatabase& db, const std::vector<RequestHolder>& requests, Json::Writer& writer,
+                     size_t thread_count = std::thread::hardware_concurrency()) {
+    const size_t chunk_size = std::max<size_t>(MIN_READ_REQUESTS_PER_THREAD,
+                                               (requests.size() + thread_count - 1) / std::max<size_t>(thread_count, 1));
+    writer.BeginArray();
+    if (requests.size() <= chunk_size) {
+        ProcessReadRequests(db, requests, 0, requests.size(), writer);
+    } else {
+        std::vector<Json::Writer> parts;
+        std::vector<std::future<void>> futures;
+        parts.reserve((requests.size() + chunk_size - 1) / chunk_size);
+        for (size_t begin = 0; begin < requests.size(); begin += chunk_size) {
+            const size_t end = std::min(begin + chunk_size, requests.size());
+            Json::Writer& part = parts.emplace_back(writer.MakeItemsWriter());
+            futures.push_back(std::async(std::launch::async, [&db, &requests, begin, end, &part] {
+                ProcessReadRequests(db, requests, begin, end, part);
+            }));
         }
-    }
-
-    return responses;
-}
-
-// void PrintResponsesJson(const std::vector<Json::Node>& responses, std::ostream& output = std::cout) {
-//     output << responses;
-//     // for (const auto& response : responses) {
-//     //     output << response << std::endl;
-//     // }
-// }
-
-void PrintResponses(const std::vector<std::string>& responses, std::ostream& output = std::cout) {
-    // вывести все элементы векторатора respo вмежду э, каждый элемент выводить на новой строке
-    // между элементами вставить запятую и пробел
-    bool first = true;
-    output << "[\n";
-    for (const auto& response : responses) {
-        if (first) {
-            output << response;
-            first = false;
-        } else {
-            output << ", \n" << response;
+        for (size_t i = 0; i < parts.size(); ++i) {
+            futures[i].get();
+            writer.AppendItems(std::move(parts[i]));
         }
     }
-    output << "\n]";
-}
\ No newline at end of file
+    writer.EndArray();
+}
@@ -1,11 +1,15 @@
 #pragma once
 
 #include "graph.h"
+#include "contraction_hierarchy.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <functional>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <unordered_map>
 #include <utility>
@@ -19,7 +23,23 @@ namespace Graph {
     using Graph = DirectedWeightedGraph<Weight>;
 
   public:
-    Router(const Graph& graph);
+    // ALL_PAIRS precomputes every route at construction: O(V^3) time, O(V^2) memory, O(1) queries.
+    // DIJKSTRA and A_STAR construct instantly and run a single-source search per BuildRoute.
+    // CONTRACTION_HIERARCHY preprocesses the graph into a hierarchy with shortcuts
+    // and answers each query with a bidirectional search that settles only a few vertices.
+    // Routes may be built from several threads at once; hierarchy queries take turns.
+    enum class Strategy {
+      ALL_PAIRS,
+      DIJKSTRA,
+      A_STAR,
+      CONTRACTION_HIERARCHY
+    };
+
+    // Lower bound of the route weight from the first vertex to the second one.
+    // Must never overestimate, otherwise A_STAR may return a suboptimal route.
+    using Heuristic = std::function<Weight(VertexId, VertexId)>;
+
+    explicit Router(const Graph& graph, Strategy strategy = Strategy::ALL_PAIRS, Heuristic heuristic = nullptr);
 
     using RouteId = uint64_t;
 
@@ -31,10 +51,12 @@ namespace Graph {
 
     std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
     EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
-    void ReleaseRoute(RouteId route_id);
+    void ReleaseRoute(RouteId route_id) const;
 
   private:
     const Graph& graph_;
+    const Strategy strategy_;
+    const Heuristic heuristic_;
 
     struct RouteInternalData {
       Weight weight;
@@ -43,9 +65,99 @@ namespace Graph {
     using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
 
     using ExpandedRoute = std::vector<EdgeId>;
+    // Guards the route cache and the scratch pool
+    mutable std::mutex mutex_;
     mutable RouteId next_route_id_ = 0;
     mutable std::unordered_map<RouteId, ExpandedRoute> expanded_routes_cache_;
 
+    // Arrays reused by single-source searches, so a query allocates nothing
+    // once they have grown. Only the touched vertices are reset after the search.
+    // Each running search takes one from the pool.
+    struct QueueItem {
+      Weight priority;
+      Weight weight;
+      VertexId vertex;
+
+      bool operator>(const QueueItem& other) const {
+        return priority > other.priority;
+      }
+    };
+
+    struct SearchScratch {
+      std::vector<std::optional<RouteInternalData>> routes;
+      std::vector<VertexId> touched_vertices;
+      std::vector<QueueItem> queue;
+    };
+    mutable std::vector<std::unique_ptr<SearchScratch>> free_scratches_;
+
+    std::unique_ptr<ContractionHierarchy<Weight>> hierarchy_;
+    mutable std::mutex hierarchy_mutex_;
+
+    std::unique_ptr<SearchScratch> AcquireScratch() const {
+      {
+        std::lock_guard guard(mutex_);
+        if (!free_scratches_.empty()) {
+          auto scratch = std::move(free_scratches_.back());
+          free_scratches_.pop_back();
+          return scratch;
+        }
+      }
+      auto scratch = std::make_unique<SearchScratch>();
+      scratch->routes.resize(graph_.GetVertexCount());
+      return scratch;
+    }
+
+    void ReleaseScratch(std::unique_ptr<SearchScratch> scratch) const {
+      std::lock_guard guard(mutex_);
+      free_scratches_.push_back(std::move(scratch));
+    }
+
+    Weight EstimateRemaining(VertexId from, VertexId to) const {
+      return strategy_ == Strategy::A_STAR ? heuristic_(from, to) : Weight(0);
+    }
+
+    void RelaxVertex(SearchScratch& scratch, VertexId vertex, const RouteInternalData& candidate, Weight estimate) const {
+      auto& route = scratch.routes[vertex];
+      if (!route) {
+        scratch.touched_vertices.push_back(vertex);
+      } else if (route->weight <= candidate.weight) {
+        return;
+      }
+      route = candidate;
+      scratch.queue.push_back({candidate.weight + estimate, candidate.weight, vertex});
+      std::push_heap(std::begin(scratch.queue), std::end(scratch.queue), std::greater<>());
+    }
+
+    // Dijkstra (or A* with the heuristic as potential) from one vertex, stopping when the target is settled.
+    // Leaves the shortest path tree in scratch.routes until ResetSearch().
+    void RunSearch(SearchScratch& scratch, VertexId from, VertexId to) const {
+      RelaxVertex(scratch, from, RouteInternalData{0, std::nullopt}, EstimateRemaining(from, to));
+      while (!scratch.queue.empty()) {
+        std::pop_heap(std::begin(scratch.queue), std::end(scratch.queue), std::greater<>());
+        const QueueItem item = scratch.queue.back();
+        scratch.queue.pop_back();
+        if (item.weight > scratch.routes[item.vertex]->weight) {
+          continue;
+        }
+        if (item.vertex == to) {
+          break;
+        }
+        for (const EdgeId edge_id : graph_.GetIncidentEdges(item.vertex)) {
+          const auto& edge = graph_.GetEdge(edge_id);
+          assert(edge.weight >= 0);
+          RelaxVertex(scratch, edge.to, RouteInternalData{item.weight + edge.weight, edge_id}, EstimateRemaining(edge.to, to));
+        }
+      }
+    }
+
+    void ResetSearch(SearchScratch& scratch) const {
+      for (const VertexId vertex : scratch.touched_vertices) {
+        scratch.routes[vertex].reset();
+      }
+      scratch.touched_vertices.clear();
+      scratch.queue.clear();
+    }
+
     void InitializeRoutesInternalData(const Graph& graph) {
       const size_t vertex_count = graph.GetVertexCount();
       for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
@@ -92,10 +204,21 @@ namespace Graph {
 
 
   template <typename Weight>
-  Router<Weight>::Router(const Graph& graph)
+  Router<Weight>::Router(const Graph& graph, Strategy strategy, Heuristic heuristic)
       : graph_(graph),
-        routes_internal_data_(graph.GetVertexCount(), std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount()))
+        strategy_(strategy),
+        heuristic_(std::move(heuristic))
   {
+    assert(strategy_ != Strategy::A_STAR || heuristic_);
+    if (strategy_ == Strategy::CONTRACTION_HIERARCHY) {
+      hierarchy_ = std::make_unique<ContractionHierarchy<Weight>>(graph);
+      return;
+    }
+    if (strategy_ != Strategy::ALL_PAIRS) {
+      return;
+    }
+
+    routes_internal_data_.assign(graph.GetVertexCount(), std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount()));
     InitializeRoutesInternalData(graph);
 
     const size_t vertex_count = graph.GetVertexCount();
@@ -106,19 +229,52 @@ namespace Graph {
 
   template <typename Weight>
   std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from, VertexId to) const {
-    const auto& route_internal_data = routes_internal_data_[from][to];
-    if (!route_internal_data) {
-      return std::nullopt;
-    }
-    const Weight weight = route_internal_data->weight;
     std::vector<EdgeId> edges;
-    for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
-         edge_id;
-         edge_id = routes_internal_data_[from][graph_.GetEdge(*edge_id).from]->prev_edge) {
-      edges.push_back(*edge_id);
+    Weight weight{};
+    if (strategy_ == Strategy::ALL_PAIRS) {
+      const auto& route_internal_data = routes_internal_data_[from][to];
+      if (!route_internal_data) {
+        return std::nullopt;
+      }
+      weight = route_internal_data->weight;
+      for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
+           edge_id;
+           edge_id = routes_internal_data_[from][graph_.GetEdge(*edge_id).from]->prev_edge) {
+        edges.push_back(*edge_id);
+      }
+      std::reverse(std::begin(edges), std::end(edges));
+    } else if (strategy_ == Strategy::CONTRACTION_HIERARCHY) {
+      std::optional<Weight> route_weight;
+      {
+        std::lock_guard guard(hierarchy_mutex_);
+        route_weight = hierarchy_->FindRoute(from, to, edges);
+      }
+      if (!route_weight) {
+        return std::nullopt;
+      }
+      weight = *route_weight;
+    } else {
+      auto scratch = AcquireScratch();
+      RunSearch(*scratch, from, to);
+      const auto& route_internal_data = scratch->routes[to];
+      const bool is_found = route_internal_data.has_value();
+      if (is_found) {
+        weight = route_internal_data->weight;
+        for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
+             edge_id;
+             edge_id = scratch->routes[graph_.GetEdge(*edge_id).from]->prev_edge) {
+          edges.push_back(*edge_id);
+        }
+        std::reverse(std::begin(edges), std::end(edges));
+      }
+      ResetSearch(*scratch);
+      ReleaseScratch(std::move(scratch));
+      if (!is_found) {
+        return std::nullopt;
+      }
     }
-    std::reverse(std::begin(edges), std::end(edges));
 
+    std::lock_guard guard(mutex_);
     const RouteId route_id = next_route_id_++;
     const size_t route_edge_count = edges.size();
     expanded_routes_cache_[route_id] = std::move(edges);
@@ -127,11 +283,13 @@ namespace Graph {
 
   template <typename Weight>
   EdgeId Router<Weight>::GetRouteEdge(RouteId route_id, size_t edge_idx) const {
+    std::lock_guard guard(mutex_);
     return expanded_routes_cache_.at(route_id)[edge_idx];
   }
 
   template <typename Weight>
-  void Router<Weight>::ReleaseRoute(RouteId route_id) {
+  void Router<Weight>::ReleaseRoute(RouteId route_id) const {
+    std::lock_guard guard(mutex_);
     expanded_routes_cache_.erase(route_id);
   }
 
@@ -0,0 +1,382 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "json.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include "requests.h"
+#include "../../test_runner.h"
+#include "../../profile.h"
+
+void TestReaderWalk() {
+    const std::string input = R"( {
+        "name": "Tolstopaltsevo",
+        "latitude": 55.611087, "skipped": [1, {"a": [true, false]}, "x"],
+        "count": -42,
+        "flag": false
+    } )";
+    Json::Reader reader(input);
+    reader.BeginObject();
+    std::vector<std::string> keys;
+    for (std::string_view key; reader.NextKey(key); ) {
+        keys.emplace_back(key);
+        if (key == "name") {
+            ASSERT_EQUAL(reader.ReadString(), "Tolstopaltsevo");
+        } else if (key == "latitude") {
+            ASSERT_EQUAL(reader.ReadDouble(), 55.611087);
+        } else if (key == "count") {
+            ASSERT_EQUAL(reader.ReadInt(), -42);
+        } else if (key == "flag") {
+            ASSERT(!reader.ReadBool());
+        } else {
+            reader.SkipValue();
+        }
+    }
+    ASSERT_EQUAL(keys, (std::vector<std::string>{"name", "latitude", "skipped", "count", "flag"}));
+}
+
+void TestReaderEscapes() {
+    const std::string input = R"(["plain", "quote \" and \\ slash \/", "line\nbreak", "\u0416\u00e9", "\ud83d\ude80"])";
+    Json::Reader reader(input);
+    std::vector<std::string> strings;
+    reader.BeginArray();
+    while (reader.NextItem()) {
+        strings.emplace_back(reader.ReadString());
+    }
+    ASSERT_EQUAL(strings, (std::vector<std::string>{
+        "plain", "quote \" and \\ slash /", "line\nbreak", "\xD0\x96\xC3\xA9", "\xF0\x9F\x9A\x80"}));
+}
+
+void TestReaderNode() {
+    const std::string input = R"({"a": [1, 2.5, "s", true], "b": {"c": 1e3}})";
+    Json::Reader reader(input);
+    const Json::Node node = reader.ReadNode();
+    const auto& a = node.AsMap().at("a").AsArray();
+    ASSERT_EQUAL(a.size(), 4u);
+    ASSERT_EQUAL(a[0].AsInt(), 1);
+    ASSERT_EQUAL(a[1].AsDouble(), 2.5);
+    ASSERT_EQUAL(a[2].AsString(), "s");
+    ASSERT(a[3].AsBool());
+    ASSERT_EQUAL(node.AsMap().at("b").AsMap().at("c").AsDouble(), 1000.);
+}
+
+void TestReadRequestsAnyKeyOrder() {
+    // "type" is neither first nor the same position in every request
+    const std::string input = R"([
+        {"name": "Marushkino", "road_distances": {"Tolstopaltsevo": 3900}, "type": "Stop",
+         "latitude": 55.595884, "longitude": 37.209755},
+        {"stops": ["Tolstopaltsevo", "Marushkino"], "is_roundtrip": false, "type": "Bus", "name": "256"},
+        {"type": "Unknown", "name": "skipped"}
+    ])";
+    Json::Reader reader(input);
+    const auto requests = ReadRequests(reader, true);
+    ASSERT_EQUAL(requests.size(), 2u);
+
+    const auto& stop_request = static_cast<const AddStopRequest&>(*requests[0]);
+    ASSERT_EQUAL(stop_request.stop.GetName(), "Marushkino");
+    ASSERT_EQUAL(stop_request.stop.GetLatitude().value(), 55.595884);
+    ASSERT_EQUAL(stop_request.stop.GetDistance("Tolstopaltsevo").value(), 3900);
+
+    const auto& bus_request = static_cast<const AddBusRequest&>(*requests[1]);
+    ASSERT_EQUAL(bus_request.bus_number, "256");
+    ASSERT_EQUAL(bus_request.stops, (std::vector<std::string>{"Tolstopaltsevo", "Marushkino", "Tolstopaltsevo"}));
+}
+
+void TestLoadOwnsStrings() {
+    static_assert(std::is_constructible_v<Json::Node, std::string>);
+    static_assert(!std::is_constructible_v<Json::NodeView, std::string>);
+
+    std::optional<Json::Document> doc;
+    {
+        std::istringstream input(R"({"stops": ["Tolstopaltsevo", "Marushkino"], "id": 7})");
+        doc.emplace(Json::Load(input));
+    }
+    const auto& root = doc->GetRoot().AsMap();
+    ASSERT_EQUAL(root.at("stops").AsArray()[1].AsString(), "Marushkino");
+    ASSERT_EQUAL(root.at("id").AsInt(), 7);
+
+    Json::Reader reader(R"(["Rasskazovka"])");
+    const Json::Node node = reader.ReadNode();
+    const std::string& name = node.AsArray()[0].AsString();
+    ASSERT_EQUAL(name, "Rasskazovka");
+}
+
+void TestLoadFile() {
+    const std::string path = "test_load_file.json";
+    {
+        std::ofstream output(path);
+        output << R"({"plain key": ["Tolstopaltsevo", "esc\"aped"], "esc\u0061ped key": 1})";
+    }
+    const Json::DocumentView doc = Json::LoadFile(path);
+    std::remove(path.c_str());
+
+    const auto& root = doc.GetRoot().AsMap();
+    ASSERT_EQUAL(root.size(), 2u);
+    const auto& array = root.at("plain key").AsArray();
+    ASSERT_EQUAL(array[0].AsString(), "Tolstopaltsevo");
+    ASSERT_EQUAL(array[1].AsString(), "esc\"aped");
+    ASSERT_EQUAL(root.at("escaped key").AsInt(), 1);
+}
+
+void TestReadRequestsFromNodes() {
+    const std::string input = R"({"base_requests": [
+        {"type": "Stop", "name": "Marushkino", "latitude": 55.595884, "longitude": 37.209755,
+         "road_distances": {"Tolstopaltsevo": 3900}},
+        {"type": "Bus", "name": "256", "stops": ["Tolstopaltsevo", "Marushkino"], "is_roundtrip": false}
+    ]})";
+    auto check_requests = [](const std::vector<RequestHolder>& requests) {
+        ASSERT_EQUAL(requests.size(), 2u);
+        const auto& stop_request = static_cast<const AddStopRequest&>(*requests[0]);
+        ASSERT_EQUAL(stop_request.stop.GetName(), "Marushkino");
+        ASSERT_EQUAL(stop_request.stop.GetDistance("Tolstopaltsevo").value(), 3900);
+        const auto& bus_request = static_cast<const AddBusRequest&>(*requests[1]);
+        ASSERT_EQUAL(bus_request.bus_number, "256");
+        ASSERT_EQUAL(bus_request.stops, (std::vector<std::string>{"Tolstopaltsevo", "Marushkino", "Tolstopaltsevo"}));
+    };
+
+    std::istringstream is(input);
+    const Json::Document doc = Json::Load(is);
+    check_requests(ReadRequests(doc.GetRoot().AsMap().at("base_requests").AsArray(), true));
+
+    const std::string path = "test_read_requests.json";
+    {
+        std::ofstream output(path);
+        output << input;
+    }
+    const Json::DocumentView doc_view = Json::LoadFile(path);
+    std::remove(path.c_str());
+    check_requests(ReadRequests(doc_view.GetRoot().AsMap().at("base_requests").AsArray(), true));
+}
+
+void TestWriter() {
+    std::ostringstream os;
+    {
+        Json::Writer writer(os);
+        writer.BeginArray();
+        writer.BeginObject()
+            .Key("name").Value("quote \" slash \\ line\n tab\t \x01")
+            .Key("empty").BeginArray().EndArray()
+            .Key("numbers").BeginArray().Value(-42).Value(size_t(7)).Value(1.318083).Value(0.1).EndArray()
+            .Key("flag").Value(true)
+            .EndObject();
+        writer.EndArray();
+    }
+    const std::string output = os.str();
+    ASSERT_EQUAL(output,
+        "[\n  {\n    \"name\": \"quote \\\" slash \\\\ line\\n tab\\t \\u0001\",\n    \"empty\": [],\n"
+        "    \"numbers\": [\n      -42,\n      7,\n      1.318083,\n      0.1\n    ],\n"
+        "    \"flag\": true\n  }\n]");
+
+    // Doubles are written so that they read back exactly
+    Json::Reader reader(output);
+    const Json::Node node = reader.ReadNode();
+    const auto& numbers = node.AsArray()[0].AsMap().at("numbers").AsArray();
+    ASSERT_EQUAL(numbers[2].AsDouble(), 1.318083);
+    ASSERT_EQUAL(node.AsArray()[0].AsMap().at("name").AsString(), "quote \" slash \\ line\n tab\t \x01");
+}
+
+void TestPrintNode() {
+    const std::string input = R"({"a": [1, 2.5, "s", true, {}], "b": {"c": -3}})";
+    Json::Reader reader(input);
+    std::ostringstream os;
+    Json::Print(reader.ReadNode(), os);
+    ASSERT_EQUAL(os.str(),
+        "{\n  \"a\": [\n    1,\n    2.5,\n    \"s\",\n    true,\n    {}\n  ],\n  \"b\": {\n    \"c\": -3\n  }\n}");
+}
+
+// base_requests of a city with the given number of stops, each with road distances
+// to its neighbours, and buses going through random stops.
+// Names are as long as the real ones, longer than the small string buffer.
+std::string GenerateTransportInput(int stop_count, int bus_count, int stops_per_bus) {
+    std::mt19937 gen(17);
+    std::uniform_int_distribution<int> stop(0, stop_count - 1);
+    std::ostringstream os;
+    os.precision(10);
+    os << "{\"base_requests\": [";
+    for (int i = 0; i < stop_count; ++i) {
+        os << (i ? "," : "") << "\n    {\"type\": \"Stop\", \"name\": \"Leninskiy prospekt " << i << "\", "
+           << "\"latitude\": " << 55. + i * 1e-5 << ", \"longitude\": " << 37. + (i % 100) * 1e-4
+           << ", \"road_distances\": {";
+        for (int j = 1; j <= 5; ++j) {
+            os << (j > 1 ? ", " : "") << "\"Leninskiy prospekt " << (i + j) % stop_count << "\": " << 1000 + j;
+        }
+        os << "}}";
+    }
+    for (int i = 0; i < bus_count; ++i) {
+        os << ",\n    {\"type\": \"Bus\", \"name\": \"Bus " << i << "\", \"is_roundtrip\": false, \"stops\": [";
+        for (int j = 0; j < stops_per_bus; ++j) {
+            os << (j ? ", " : "") << "\"Leninskiy prospekt " << stop(gen) << "\"";
+        }
+        os << "]}";
+    }
+    os << "\n], \"stat_requests\": []}";
+    return os.str();
+}
+
+// The char-by-char DOM loader with owned strings against the pull reader
+void BenchmarkReadRequests() {
+    const std::string input = GenerateTransportInput(100000, 20000, 20);
+    std::cerr << "Input size: " << input.size() / 1024 / 1024 << " MiB" << std::endl;
+
+    size_t dom_count = 0;
+    {
+        LOG_DURATION("Json::Load (istream DOM) + ReadRequests");
+        std::istringstream is(input);
+        const Json::Document doc = Json::Load(is);
+        dom_count = ReadRequests(doc.GetRoot().AsMap().at("base_requests").AsArray(), true).size();
+    }
+    size_t stream_count = 0;
+    {
+        LOG_DURATION("Json::Reader + ReadRequests");
+        std::istringstream is(input);
+        const std::string buffer = Json::ReadWholeInput(is);
+        Json::Reader reader(buffer);
+        reader.BeginObject();
+        for (std::string_view key; reader.NextKey(key); ) {
+            if (key == "base_requests") {
+                stream_count = ReadRequests(reader, true).size();
+            } else {
+                reader.SkipValue();
+            }
+        }
+    }
+    ASSERT_EQUAL(dom_count, stream_count);
+}
+
+// Responses to Bus requests, formatted the old way (a string per response) and by the writer
+void BenchmarkWriteResponses() {
+    const int response_count = 1000000;
+    size_t old_size = 0;
+    {
+        LOG_DURATION("ostringstream responses");
+        std::vector<std::string> responses;
+        for (int i = 0; i < response_count; ++i) {
+            std::ostringstream os;
+            os << "{\n";
+            os << "  \"route_length\": " << 10000 + i << ",\n";
+            os << "  \"request_id\": " << 1000000000 + i << ",\n";
+            os << "  \"curvature\": " << std::fixed << std::setprecision(6) << 1. + i * 1e-7 << ",\n";
+            os << "  \"stop_count\": " << i % 100 << ",\n";
+            os << "  \"unique_stop_count\": " << i % 50 << "\n";
+            os << "}";
+            responses.push_back(os.str());
+        }
+        std::ostringstream output;
+        output << "[\n";
+        for (size_t i = 0; i < responses.size(); ++i) {
+            output << (i ? ", \n" : "") << responses[i];
+        }
+        output << "\n]";
+        old_size = output.str().size();
+    }
+    size_t writer_size = 0;
+    {
+        LOG_DURATION("Json::Writer responses");
+        std::ostringstream output;
+        {
+            Json::Writer writer(output);
+            writer.BeginArray();
+            for (int i = 0; i < response_count; ++i) {
+                writer.BeginObject()
+                    .Key("route_length").Value(10000 + i)
+                    .Key("request_id").Value(1000000000 + i)
+                    .Key("curvature").Value(1. + i * 1e-7)
+                    .Key("stop_count").Value(size_t(i % 100))
+                    .Key("unique_stop_count").Value(size_t(i % 50))
+                    .EndObject();
+            }
+            writer.EndArray();
+        }
+        writer_size = output.str().size();
+    }
+    std::cerr << "Output size: " << old_size / 1024 / 1024 << " MiB vs "
+              << writer_size / 1024 / 1024 << " MiB" << std::endl;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+// Runs the loader in a child process, so that each one gets its own peak RSS.
+template <typename LoadFunc>
+void MeasureLoader(const std::string& name, LoadFunc load) {
+    std::cerr.flush();
+    const pid_t pid = fork();
+    if (pid == 0) {
+        size_t request_count = 0;
+        {
+            LOG_DURATION(name);
+            request_count = load();
+        }
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        std::cerr << name << ": " << request_count << " requests, peak RSS "
+                  << usage.ru_maxrss / 1024 << " MiB" << std::endl;
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+void BenchmarkLoadModes() {
+    const std::string path = "benchmark_input.json";
+    {
+        std::ofstream output(path);
+        output << GenerateTransportInput(300000, 60000, 20);
+    }
+    auto read_base_requests = [](const auto& doc) {
+        return ReadRequests(doc.GetRoot().AsMap().at("base_requests").AsArray(), true).size();
+    };
+    MeasureLoader("Json::Load from ifstream (owned strings)", [&] {
+        std::ifstream input(path);
+        return read_base_requests(Json::Load(input));
+    });
+    MeasureLoader("Json::LoadFile (string_views into mmap)", [&] {
+        return read_base_requests(Json::LoadFile(path));
+    });
+    MeasureLoader("Json::Reader over mmap", [&] {
+        const auto source = Json::Source::FromFile(path);
+        Json::Reader reader(source->GetText());
+        size_t count = 0;
+        reader.BeginObject();
+        for (std::string_view key; reader.NextKey(key); ) {
+            if (key == "base_requests") {
+                count = ReadRequests(reader, true).size();
+            } else {
+                reader.SkipValue();
+            }
+        }
+        return count;
+    });
+    std::remove(path.c_str());
+}
+#else
+void BenchmarkLoadModes() {
+}
+#endif
+
+void TestAllJson() {
+    TestRunner tr;
+    RUN_TEST(tr, TestReaderWalk);
+    RUN_TEST(tr, TestReaderEscapes);
+    RUN_TEST(tr, TestReaderNode);
+    RUN_TEST(tr, TestReadRequestsAnyKeyOrder);
+    RUN_TEST(tr, TestLoadOwnsStrings);
+    RUN_TEST(tr, TestLoadFile);
+    RUN_TEST(tr, TestReadRequestsFromNodes);
+    RUN_TEST(tr, TestWriter);
+    RUN_TEST(tr, TestPrintNode);
+    RUN_TEST(tr, BenchmarkReadRequests);
+    RUN_TEST(tr, BenchmarkLoadModes);
+    RUN_TEST(tr, BenchmarkWriteResponses);
+}
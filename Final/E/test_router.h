@@ -0,0 +1,349 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <random>
+#include <vector>
+
+#include "graph.h"
+#include "router.h"
+#include "../../test_runner.h"
+#include "../../profile.h"
+
+// Square grid with random weights not less than the euclidean length of an edge,
+// so the euclidean distance is an admissible A* heuristic.
+struct TestGridGraph {
+    size_t side;
+    Graph::DirectedWeightedGraph<double> graph;
+
+    TestGridGraph(size_t side, unsigned seed) : side(side), graph(side * side) {
+        std::mt19937 gen(seed);
+        std::uniform_real_distribution<double> extra(0., 3.);
+        for (size_t row = 0; row < side; ++row) {
+            for (size_t col = 0; col < side; ++col) {
+                const Graph::VertexId vertex = row * side + col;
+                if (col + 1 < side) {
+                    graph.AddEdge({vertex, vertex + 1, 1. + extra(gen)});
+                    graph.AddEdge({vertex + 1, vertex, 1. + extra(gen)});
+                }
+                if (row + 1 < side) {
+                    graph.AddEdge({vertex, vertex + side, 1. + extra(gen)});
+                    graph.AddEdge({vertex + side, vertex, 1. + extra(gen)});
+                }
+            }
+        }
+    }
+
+    double Distance(Graph::VertexId from, Graph::VertexId to) const {
+        const double d_row = double(from / side) - double(to / side);
+        const double d_col = double(from % side) - double(to % side);
+        return std::sqrt(d_row * d_row + d_col * d_col);
+    }
+};
+
+template <typename Weight>
+double ComputeRouteWeight(const Graph::DirectedWeightedGraph<Weight>& graph, Graph::Router<Weight>& router,
+                          const typename Graph::Router<Weight>::RouteInfo& route, Graph::VertexId from, Graph::VertexId to) {
+    Weight weight = 0;
+    Graph::VertexId current = from;
+    for (size_t i = 0; i < route.edge_count; ++i) {
+        const auto& edge = graph.GetEdge(router.GetRouteEdge(route.id, i));
+        ASSERT_EQUAL(edge.from, current);
+        current = edge.to;
+        weight += edge.weight;
+    }
+    ASSERT_EQUAL(current, to);
+    router.ReleaseRoute(route.id);
+    return weight;
+}
+
+void TestRouterStrategiesAgree() {
+    using Router = Graph::Router<double>;
+    const TestGridGraph grid(12, 7);
+    const auto heuristic = [&grid](Graph::VertexId from, Graph::VertexId to) {
+        return grid.Distance(from, to);
+    };
+
+    Router all_pairs(grid.graph);
+    Router dijkstra(grid.graph, Router::Strategy::DIJKSTRA);
+    Router a_star(grid.graph, Router::Strategy::A_STAR, heuristic);
+    Router hierarchy(grid.graph, Router::Strategy::CONTRACTION_HIERARCHY);
+
+    const size_t vertex_count = grid.graph.GetVertexCount();
+    for (Graph::VertexId from = 0; from < vertex_count; from += 5) {
+        for (Graph::VertexId to = 0; to < vertex_count; to += 3) {
+            const auto expected = all_pairs.BuildRoute(from, to);
+            ASSERT(expected.has_value());
+            all_pairs.ReleaseRoute(expected->id);
+            for (Router* router : {&dijkstra, &a_star, &hierarchy}) {
+                const auto route = router->BuildRoute(from, to);
+                ASSERT(route.has_value());
+                ASSERT(std::abs(route->weight - expected->weight) < 1e-9);
+                ASSERT(std::abs(ComputeRouteWeight(grid.graph, *router, *route, from, to) - route->weight) < 1e-9);
+            }
+        }
+    }
+}
+
+void TestRouterConcurrentQueries() {
+    using Router = Graph::Router<double>;
+    const TestGridGraph grid(15, 3);
+    for (const auto strategy : {Router::Strategy::DIJKSTRA, Router::Strategy::CONTRACTION_HIERARCHY}) {
+        const Router router(grid.graph, strategy);
+        std::vector<std::future<void>> futures;
+        for (size_t thread = 0; thread < 4; ++thread) {
+            futures.push_back(std::async(std::launch::async, [&, thread] {
+                for (Graph::VertexId from = thread; from < grid.graph.GetVertexCount(); from += 4) {
+                    const Graph::VertexId to = grid.graph.GetVertexCount() - 1 - from;
+                    const auto route = router.BuildRoute(from, to);
+                    ASSERT(route.has_value());
+                    Graph::VertexId current = from;
+                    for (size_t i = 0; i < route->edge_count; ++i) {
+                        current = grid.graph.GetEdge(router.GetRouteEdge(route->id, i)).to;
+                    }
+                    ASSERT_EQUAL(current, to);
+                    router.ReleaseRoute(route->id);
+                }
+            }));
+        }
+        for (auto& f : futures) {
+            f.get();
+        }
+    }
+}
+
+void TestRouterUnreachable() {
+    using Router = Graph::Router<int>;
+    Graph::DirectedWeightedGraph<int> graph(4);
+    graph.AddEdge({0, 1, 5});
+    graph.AddEdge({1, 2, 5});
+    graph.AddEdge({0, 2, 20});
+
+    for (const auto strategy : {Router::Strategy::ALL_PAIRS, Router::Strategy::DIJKSTRA, Router::Strategy::CONTRACTION_HIERARCHY}) {
+        Router router(graph, strategy);
+        ASSERT(!router.BuildRoute(0, 3).has_value());
+        ASSERT(!router.BuildRoute(2, 0).has_value());
+
+        const auto to_itself = router.BuildRoute(1, 1);
+        ASSERT(to_itself.has_value());
+        ASSERT_EQUAL(to_itself->weight, 0);
+        ASSERT_EQUAL(to_itself->edge_count, 0u);
+
+        const auto route = router.BuildRoute(0, 2);
+        ASSERT(route.has_value());
+        ASSERT_EQUAL(route->weight, 10);
+        ASSERT_EQUAL(route->edge_count, 2u);
+        ASSERT_EQUAL(router.GetRouteEdge(route->id, 0), 0u);
+        ASSERT_EQUAL(router.GetRouteEdge(route->id, 1), 1u);
+        router.ReleaseRoute(route->id);
+    }
+}
+
+void TestContractionHierarchyRandomGraph() {
+    using Router = Graph::Router<int>;
+    std::mt19937 gen(3);
+    const size_t vertex_count = 300;
+    std::uniform_int_distribution<Graph::VertexId> vertex(0, vertex_count - 1);
+    std::uniform_int_distribution<int> weight(0, 100);
+
+    // Sparse enough to leave some pairs unreachable, with parallel edges and loops.
+    Graph::DirectedWeightedGraph<int> graph(vertex_count);
+    for (size_t i = 0; i < 2 * vertex_count; ++i) {
+        graph.AddEdge({vertex(gen), vertex(gen), weight(gen)});
+    }
+
+    Router all_pairs(graph);
+    Router hierarchy(graph, Router::Strategy::CONTRACTION_HIERARCHY);
+    for (Graph::VertexId from = 0; from < vertex_count; from += 7) {
+        for (Graph::VertexId to = 0; to < vertex_count; ++to) {
+            const auto expected = all_pairs.BuildRoute(from, to);
+            const auto route = hierarchy.BuildRoute(from, to);
+            ASSERT_EQUAL(route.has_value(), expected.has_value());
+            if (expected) {
+                all_pairs.ReleaseRoute(expected->id);
+                ASSERT_EQUAL(route->weight, expected->weight);
+                ASSERT_EQUAL(ComputeRouteWeight(graph, hierarchy, *route, from, to), route->weight);
+            }
+        }
+    }
+}
+
+void TestFrozenGraph() {
+    using Router = Graph::Router<int>;
+    std::mt19937 gen(5);
+    const size_t vertex_count = 200;
+    std::uniform_int_distribution<Graph::VertexId> vertex(0, vertex_count - 1);
+    std::uniform_int_distribution<int> weight(0, 100);
+    Graph::DirectedWeightedGraph<int> graph(vertex_count);
+    for (size_t i = 0; i < 3 * vertex_count; ++i) {
+        graph.AddEdge({vertex(gen), vertex(gen), weight(gen)});
+    }
+    Graph::DirectedWeightedGraph<int> frozen = graph;
+    const std::vector<Graph::EdgeId> new_ids = frozen.Freeze();
+    ASSERT(frozen.IsFrozen());
+    ASSERT_EQUAL(frozen.GetVertexCount(), vertex_count);
+    ASSERT_EQUAL(frozen.GetEdgeCount(), graph.GetEdgeCount());
+
+    // Same edges in the same order, now under consecutive ids
+    for (Graph::VertexId v = 0; v < vertex_count; ++v) {
+        std::vector<Graph::EdgeId> expected;
+        for (const Graph::EdgeId edge_id : graph.GetIncidentEdges(v)) {
+            expected.push_back(new_ids[edge_id]);
+            const auto& edge = graph.GetEdge(edge_id);
+            const auto& frozen_edge = frozen.GetEdge(new_ids[edge_id]);
+            ASSERT_EQUAL(frozen_edge.from, edge.from);
+            ASSERT_EQUAL(frozen_edge.to, edge.to);
+            ASSERT_EQUAL(frozen_edge.weight, edge.weight);
+        }
+        const auto range = frozen.GetIncidentEdges(v);
+        ASSERT_EQUAL(std::vector<Graph::EdgeId>(range.begin(), range.end()), expected);
+    }
+
+    Router router(graph, Router::Strategy::DIJKSTRA);
+    Router frozen_router(frozen, Router::Strategy::DIJKSTRA);
+    for (Graph::VertexId from = 0; from < vertex_count; from += 11) {
+        for (Graph::VertexId to = 0; to < vertex_count; ++to) {
+            const auto expected = router.BuildRoute(from, to);
+            const auto route = frozen_router.BuildRoute(from, to);
+            ASSERT_EQUAL(route.has_value(), expected.has_value());
+            if (expected) {
+                router.ReleaseRoute(expected->id);
+                ASSERT_EQUAL(route->weight, expected->weight);
+                ASSERT_EQUAL(ComputeRouteWeight(frozen, frozen_router, *route, from, to), route->weight);
+            }
+        }
+    }
+}
+
+template <typename BuildRouter>
+void BenchmarkRouter(const std::string& name, const TestGridGraph& grid, size_t query_count, BuildRouter build_router) {
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<Graph::VertexId> vertex(0, grid.graph.GetVertexCount() - 1);
+    double total_weight = 0;
+    {
+        LOG_DURATION(name + ": construction + " + std::to_string(query_count) + " queries");
+        auto router = build_router();
+        {
+            LOG_DURATION(name + ": queries");
+            for (size_t i = 0; i < query_count; ++i) {
+                if (const auto route = router->BuildRoute(vertex(gen), vertex(gen))) {
+                    total_weight += route->weight;
+                    router->ReleaseRoute(route->id);
+                }
+            }
+        }
+    }
+    std::cerr << name << ": total weight " << total_weight << std::endl;
+}
+
+void BenchmarkRouterStrategies() {
+    using Router = Graph::Router<double>;
+    for (const size_t side : {20, 30}) {
+        const TestGridGraph grid(side, 1);
+        const auto heuristic = [&grid](Graph::VertexId from, Graph::VertexId to) {
+            return grid.Distance(from, to);
+        };
+        const std::string suffix = " (" + std::to_string(side * side) + " vertices)";
+        BenchmarkRouter("All pairs" + suffix, grid, 10000, [&grid] {
+            return std::make_unique<Router>(grid.graph);
+        });
+        BenchmarkRouter("Dijkstra" + suffix, grid, 10000, [&grid] {
+            return std::make_unique<Router>(grid.graph, Router::Strategy::DIJKSTRA);
+        });
+        BenchmarkRouter("A*" + suffix, grid, 10000, [&grid, &heuristic] {
+            return std::make_unique<Router>(grid.graph, Router::Strategy::A_STAR, heuristic);
+        });
+    }
+}
+
+void BenchmarkContractionHierarchy() {
+    using Router = Graph::Router<double>;
+    {
+        const TestGridGraph grid(30, 1);
+        const size_t vertex_count = grid.graph.GetVertexCount();
+        std::cerr << "All pairs (" << vertex_count << " vertices): "
+                  << vertex_count * vertex_count * sizeof(std::optional<std::pair<double, std::optional<Graph::EdgeId>>>) / 1024
+                  << " KiB of routes" << std::endl;
+        const Graph::ContractionHierarchy<double> hierarchy(grid.graph);
+        std::cerr << "Contraction hierarchy (" << vertex_count << " vertices): "
+                  << hierarchy.GetShortcutCount() << " shortcuts, "
+                  << hierarchy.GetMemoryUsage() / 1024 << " KiB" << std::endl;
+        BenchmarkRouter("Contraction hierarchy (900 vertices)", grid, 10000, [&grid] {
+            return std::make_unique<Router>(grid.graph, Router::Strategy::CONTRACTION_HIERARCHY);
+        });
+    }
+    {
+        const TestGridGraph grid(100, 1);
+        BenchmarkRouter("Dijkstra (10000 vertices)", grid, 1000, [&grid] {
+            return std::make_unique<Router>(grid.graph, Router::Strategy::DIJKSTRA);
+        });
+        BenchmarkRouter("Contraction hierarchy (10000 vertices)", grid, 1000, [&grid] {
+            return std::make_unique<Router>(grid.graph, Router::Strategy::CONTRACTION_HIERARCHY);
+        });
+    }
+}
+
+// Road-like graph of 100k vertices whose edges were added in random order,
+// so the edges of one vertex lie all over the edge array until it is frozen
+void BenchmarkFrozenGraph() {
+    using Router = Graph::Router<double>;
+    const size_t side = 317;
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<double> extra(0., 3.);
+    std::vector<Graph::Edge<double>> edges;
+    for (size_t row = 0; row < side; ++row) {
+        for (size_t col = 0; col < side; ++col) {
+            const Graph::VertexId vertex = row * side + col;
+            if (col + 1 < side) {
+                edges.push_back({vertex, vertex + 1, 1. + extra(gen)});
+                edges.push_back({vertex + 1, vertex, 1. + extra(gen)});
+            }
+            if (row + 1 < side) {
+                edges.push_back({vertex, vertex + side, 1. + extra(gen)});
+                edges.push_back({vertex + side, vertex, 1. + extra(gen)});
+            }
+        }
+    }
+    std::shuffle(edges.begin(), edges.end(), gen);
+    Graph::DirectedWeightedGraph<double> graph(side * side);
+    for (const auto& edge : edges) {
+        graph.AddEdge(edge);
+    }
+    Graph::DirectedWeightedGraph<double> frozen = graph;
+    {
+        LOG_DURATION("Freeze 100k vertices");
+        frozen.Freeze();
+    }
+
+    const size_t query_count = 100;
+    std::uniform_int_distribution<Graph::VertexId> vertex(0, side * side - 1);
+    std::vector<std::pair<Graph::VertexId, Graph::VertexId>> queries;
+    for (size_t i = 0; i < query_count; ++i) {
+        queries.emplace_back(vertex(gen), vertex(gen));
+    }
+    double weights[2] = {0, 0};
+    const Graph::DirectedWeightedGraph<double>* graphs[2] = {&graph, &frozen};
+    for (size_t i = 0; i < 2; ++i) {
+        const Router router(*graphs[i], Router::Strategy::DIJKSTRA);
+        LOG_DURATION(std::string(i ? "Frozen" : "Incidence lists") + ": " + std::to_string(query_count) + " Dijkstra queries");
+        for (const auto& [from, to] : queries) {
+            const auto route = router.BuildRoute(from, to);
+            weights[i] += route->weight;
+            router.ReleaseRoute(route->id);
+        }
+    }
+    ASSERT(std::abs(weights[0] - weights[1]) < 1e-6 * weights[0]);
+}
+
+void TestAllRouter() {
+    TestRunner tr;
+    RUN_TEST(tr, TestRouterStrategiesAgree);
+    RUN_TEST(tr, TestRouterConcurrentQueries);
+    RUN_TEST(tr, TestRouterUnreachable);
+    RUN_TEST(tr, TestContractionHierarchyRandomGraph);
+    RUN_TEST(tr, TestFrozenGraph);
+    RUN_TEST(tr, BenchmarkRouterStrategies);
+    RUN_TEST(tr, BenchmarkContractionHierarchy);
+    RUN_TEST(tr, BenchmarkFrozenGraph);
+}
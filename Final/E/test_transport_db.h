@@ -0,0 +1,388 @@
+#pragma once
+
+#include "transport_db.h"
+#include "requests.h"
+#include "../../test_runner.h"
+#include "../../profile.h"
+#include "json.h"
+#include "json_writer.h"
+
+#include <random>
+
+TransportDatabase MakeTestDatabase() {
+    using namespace Json;
+    std::istringstream is(R"([
+        {
+            "type": "Stop",
+            "road_distances": {
+                "Marushkino": 3900,
+                "Lugovaya": 1200
+            },
+            "longitude": 37.20829,
+            "name": "Tolstopaltsevo",
+            "latitude": 55.611087
+        },
+        {
+            "type": "Stop",
+            "road_distances": {
+                "Rasskazovka": 9900
+            },
+            "longitude": 37.209755,
+            "name": "Marushkino",
+            "latitude": 55.595884
+        },
+        {
+            "type": "Bus",
+            "name": "750",
+            "stops": [
+                "Tolstopaltsevo",
+                "Marushkino",
+                "Rasskazovka"
+            ],
+            "is_roundtrip": false
+        },
+        {
+            "type": "Bus",
+            "name": "256",
+            "stops": [
+                "Marushkino",
+                "Rasskazovka",
+                "Marushkino"
+            ],
+            "is_roundtrip": true
+        },
+        {
+            "type": "Stop",
+            "road_distances": {
+                "Marushkino": 9500
+            },
+            "longitude": 37.333324,
+            "name": "Rasskazovka",
+            "latitude": 55.632761
+        }
+    ])");
+    TransportDatabase db;
+    const Document doc = Load(is);
+    ProcessModifyRequests(&db, ReadRequests(doc.GetRoot().AsArray(), true));
+    return db;
+}
+
+std::string WriteStopInfo(const TransportDatabase& db, std::string_view stop_name, int id) {
+    std::ostringstream os;
+    {
+        Json::Writer writer(os);
+        db.WriteStopInfo(stop_name, id, writer);
+    }
+    return os.str();
+}
+
+std::string WriteBusInfo(const TransportDatabase& db, std::string_view bus_number, int id) {
+    std::ostringstream os;
+    {
+        Json::Writer writer(os);
+        db.WriteBusInfo(bus_number, id, writer);
+    }
+    return os.str();
+}
+
+void TestStopInfo() {
+    const TransportDatabase db = MakeTestDatabase();
+    // Buses are listed by name, not in the order they were added
+    ASSERT_EQUAL(WriteStopInfo(db, "Marushkino", 1),
+        "{\n  \"buses\": [\n    \"256\",\n    \"750\"\n  ],\n  \"request_id\": 1\n}");
+    ASSERT_EQUAL(WriteStopInfo(db, "Tolstopaltsevo", 2),
+        "{\n  \"buses\": [\n    \"750\"\n  ],\n  \"request_id\": 2\n}");
+    // Lugovaya is only mentioned in road_distances
+    ASSERT_EQUAL(WriteStopInfo(db, "Lugovaya", 3),
+        "{\n  \"error_message\": \"not found\",\n  \"request_id\": 3\n}");
+}
+
+void TestRoadDistances() {
+    const TransportDatabase db = MakeTestDatabase();
+    const StopId tolstopaltsevo = *db.FindStop("Tolstopaltsevo");
+    const StopId marushkino = *db.FindStop("Marushkino");
+    const StopId rasskazovka = *db.FindStop("Rasskazovka");
+    ASSERT_EQUAL(db.FindDistance(tolstopaltsevo, marushkino), 3900);
+    // No distance in this direction, falls back to the reverse one
+    ASSERT_EQUAL(db.FindDistance(marushkino, tolstopaltsevo), 3900);
+    ASSERT_EQUAL(db.FindDistance(marushkino, rasskazovka), 9900);
+    ASSERT_EQUAL(db.FindDistance(rasskazovka, marushkino), 9500);
+    ASSERT_EQUAL(db.GetStopName(rasskazovka), "Rasskazovka");
+}
+
+void TestBusInfo() {
+    const TransportDatabase db = MakeTestDatabase();
+    ASSERT_EQUAL(db.GetBus("750").GetRoute().size(), 5u);
+    const std::string info = WriteBusInfo(db, "750", 4);
+    ASSERT(info.find("\"route_length\": 27200,") != std::string::npos);
+    ASSERT(info.find("\"stop_count\": 5,") != std::string::npos);
+    ASSERT(info.find("\"unique_stop_count\": 3\n") != std::string::npos);
+    ASSERT_EQUAL(WriteBusInfo(db, "751", 5),
+        "{\n  \"error_message\": \"not found\",\n  \"request_id\": 5\n}");
+}
+
+void TestBusStatsCache() {
+    TransportDatabase db = MakeTestDatabase();
+    const BusId bus_id = 1;  // "256" was added second
+    ASSERT_EQUAL(db.GetBusName(bus_id), "256");
+    const BusStats stats = db.GetBusStats(bus_id);
+    ASSERT_EQUAL(stats.stop_count, 3u);
+    ASSERT_EQUAL(stats.unique_stop_count, 2u);
+    ASSERT_EQUAL(stats.route_length, 9900 + 9500);
+
+    // Changes after Finalize must not be answered from the cache
+    db.AddBus("256", {"Marushkino", "Rasskazovka", "Marushkino", "Rasskazovka"});
+    ASSERT_EQUAL(db.GetBusStats(bus_id).stop_count, 4u);
+    ASSERT_EQUAL(db.GetBusStats(bus_id).route_length, 9900 + 9500 + 9900);
+}
+
+void TestParallelFinalize() {
+    TransportDatabase db;
+    const int stop_count = 50;
+    for (int i = 0; i < stop_count; ++i) {
+        Stop stop("Stop " + std::to_string(i));
+        stop.SetLatitude(55. + i * 0.001);
+        stop.SetLongitude(37. + (i % 7) * 0.001);
+        for (int j = 0; j < stop_count; ++j) {
+            stop.AddDistance("Stop " + std::to_string(j), 1000 + i + j);
+        }
+        db.AddStop(stop);
+    }
+    const int bus_count = 2000;
+    for (int i = 0; i < bus_count; ++i) {
+        std::vector<std::string> route;
+        for (int j = 0; j < 10; ++j) {
+            route.push_back("Stop " + std::to_string((i * 7 + j * j) % stop_count));
+        }
+        db.AddBus(std::to_string(i), route);
+    }
+
+    std::vector<BusStats> expected;
+    for (BusId bus_id = 0; bus_id < bus_count; ++bus_id) {
+        expected.push_back(db.GetBusStats(bus_id));
+    }
+    db.Finalize(4);
+    for (BusId bus_id = 0; bus_id < bus_count; ++bus_id) {
+        const BusStats stats = db.GetBusStats(bus_id);
+        ASSERT_EQUAL(stats.stop_count, expected[bus_id].stop_count);
+        ASSERT_EQUAL(stats.unique_stop_count, expected[bus_id].unique_stop_count);
+        ASSERT_EQUAL(stats.route_length, expected[bus_id].route_length);
+        ASSERT_EQUAL(stats.curvature, expected[bus_id].curvature);
+    }
+}
+
+void TestRoute() {
+    TransportDatabase db = MakeTestDatabase();
+    db.SetRoutingSettings({6, 40});
+    db.Finalize();
+    const auto find_route = [&db](std::string_view from, std::string_view to) {
+        std::ostringstream os;
+        {
+            Json::Writer writer(os);
+            db.WriteRouteInfo(from, to, 7, writer);
+        }
+        std::istringstream is(os.str());
+        return Json::Load(is);
+    };
+
+    {
+        const Json::Document route = find_route("Tolstopaltsevo", "Rasskazovka");
+        const auto& response = route.GetRoot().AsMap();
+        ASSERT_EQUAL(response.at("request_id").AsInt(), 7);
+        // 40 km/h is 2000 / 3 meters per minute
+        ASSERT(std::abs(response.at("total_time").AsDouble() - (6 + (3900 + 9900) * 3. / 2000)) < 1e-9);
+        const auto& items = response.at("items").AsArray();
+        ASSERT_EQUAL(items.size(), 2u);
+        ASSERT_EQUAL(items[0].AsMap().at("type").AsString(), "Wait");
+        ASSERT_EQUAL(items[0].AsMap().at("stop_name").AsString(), "Tolstopaltsevo");
+        ASSERT_EQUAL(items[0].AsMap().at("time").AsDouble(), 6.);
+        ASSERT_EQUAL(items[1].AsMap().at("type").AsString(), "Bus");
+        ASSERT_EQUAL(items[1].AsMap().at("bus").AsString(), "750");
+        ASSERT_EQUAL(items[1].AsMap().at("span_count").AsInt(), 2);
+    }
+    {
+        const Json::Document route = find_route("Marushkino", "Marushkino");
+        ASSERT_EQUAL(route.GetRoot().AsMap().at("total_time").AsDouble(), 0.);
+        ASSERT(route.GetRoot().AsMap().at("items").AsArray().empty());
+    }
+    {
+        // Lugovaya is only mentioned in road_distances
+        const Json::Document route = find_route("Tolstopaltsevo", "Lugovaya");
+        ASSERT_EQUAL(route.GetRoot().AsMap().at("error_message").AsString(), "not found");
+    }
+}
+
+void TestRouteGraphIsLinear() {
+    // A 4-stop route gets 4 boarding, 4 alighting and 3 riding edges
+    TransportRouter router(4, 4 + 2, {2, 60});
+    router.AddBus(0, {0, 1, 2, 3}, {1000, 1000, 1000});
+    router.AddBus(1, {3, 0}, {500});
+    router.Build();
+    ASSERT_EQUAL(router.GetEdgeCount(), 11u + 5u);
+
+    // Changing buses at stop 3: wait, three spans, wait again, one span
+    const auto itinerary = router.FindRoute(1, 0);
+    ASSERT(itinerary.has_value());
+    ASSERT_EQUAL(itinerary->items.size(), 4u);
+    ASSERT_EQUAL(itinerary->items[1].span_count, 2u);
+    ASSERT_EQUAL(itinerary->items[2].id, 3u);
+    ASSERT_EQUAL(itinerary->items[3].span_count, 1u);
+    ASSERT(std::abs(itinerary->total_time - (2 + 2 + 2 + 0.5)) < 1e-9);
+    ASSERT(router.FindRoute(0, 0)->items.empty());
+}
+
+void TestRouteAStarAgreesWithAllPairs() {
+    // Road distances are up to 30% shorter and 50% longer than straight lines
+    const size_t stop_count = 60;
+    const size_t bus_count = 15;
+    const size_t route_size = 12;
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<double> coordinate_dis(0., 0.1);
+    std::uniform_real_distribution<double> detour_dis(0.7, 1.5);
+    std::uniform_int_distribution<size_t> stop_dis(0, stop_count - 1);
+
+    std::vector<StopRecord> stops(stop_count);
+    for (StopRecord& stop : stops) {
+        stop.latitude = 55.6 + coordinate_dis(gen);
+        stop.longitude = 37.5 + coordinate_dis(gen);
+    }
+    std::vector<std::vector<StopId>> routes(bus_count);
+    std::vector<std::vector<int>> distances(bus_count);
+    for (BusId bus_id = 0; bus_id < bus_count; ++bus_id) {
+        for (size_t i = 0; i < route_size; ++i) {
+            routes[bus_id].push_back(stop_dis(gen));
+            if (i > 0) {
+                const double geo_distance = TransportDatabase::ComputeDistance(stops[routes[bus_id][i - 1]], stops[routes[bus_id][i]]);
+                distances[bus_id].push_back(static_cast<int>(geo_distance * detour_dis(gen)) + 1);
+            }
+        }
+    }
+
+    auto make_router = [&](const char* settings_json) {
+        Json::Reader reader(settings_json);
+        auto router = std::make_unique<TransportRouter>(stop_count, bus_count * route_size, RoutingSettings::ParseFrom(reader));
+        for (StopId stop_id = 0; stop_id < stop_count; ++stop_id) {
+            router->SetStopCoordinates(stop_id, *stops[stop_id].latitude, *stops[stop_id].longitude);
+        }
+        for (BusId bus_id = 0; bus_id < bus_count; ++bus_id) {
+            router->AddBus(bus_id, routes[bus_id], distances[bus_id]);
+        }
+        router->Build();
+        return router;
+    };
+    const auto all_pairs = make_router(R"({"bus_wait_time": 3, "bus_velocity": 30, "router_strategy": "all_pairs"})");
+    const auto a_star = make_router(R"({"router_strategy": "a_star", "bus_wait_time": 3, "bus_velocity": 30})");
+
+    size_t found_count = 0;
+    for (StopId from = 0; from < stop_count; ++from) {
+        for (StopId to = 0; to < stop_count; ++to) {
+            const auto expected = all_pairs->FindRoute(from, to);
+            const auto itinerary = a_star->FindRoute(from, to);
+            ASSERT_EQUAL(itinerary.has_value(), expected.has_value());
+            if (expected) {
+                ++found_count;
+                ASSERT(std::abs(itinerary->total_time - expected->total_time) < 1e-9);
+                double items_time = 0;
+                for (const auto& item : itinerary->items) {
+                    items_time += item.time;
+                }
+                ASSERT(std::abs(items_time - itinerary->total_time) < 1e-9);
+            }
+        }
+    }
+    ASSERT(found_count > stop_count * stop_count / 2);
+}
+
+TransportDatabase MakeLargeTestDatabase(int stop_count, int bus_count) {
+    TransportDatabase db;
+    for (int i = 0; i < stop_count; ++i) {
+        Stop stop("Stop " + std::to_string(i));
+        stop.SetLatitude(55. + i * 1e-4);
+        stop.SetLongitude(37. + (i % 97) * 1e-4);
+        for (int j = 1; j <= 3; ++j) {
+            stop.AddDistance("Stop " + std::to_string((i + j) % stop_count), 1000 + j);
+        }
+        db.AddStop(stop);
+    }
+    for (int i = 0; i < bus_count; ++i) {
+        std::vector<std::string> route;
+        // Consecutive stops, so that every pair has a road distance
+        for (int j = 0; j < 20; ++j) {
+            route.push_back("Stop " + std::to_string((i * 31 + j) % stop_count));
+        }
+        db.AddBus(std::to_string(i), route);
+    }
+    db.Finalize();
+    return db;
+}
+
+std::vector<RequestHolder> MakeReadRequests(int request_count, int stop_count, int bus_count) {
+    std::vector<RequestHolder> requests;
+    for (int i = 0; i < request_count; ++i) {
+        // Some names are unknown to get "not found" responses too
+        if (i % 2) {
+            auto request = std::make_unique<StopRequest>();
+            request->stop_name = "Stop " + std::to_string(i % (stop_count + 10));
+            request->id = i;
+            requests.push_back(std::move(request));
+        } else {
+            auto request = std::make_unique<BusRequest>();
+            request->bus_number = std::to_string(i % (bus_count + 10));
+            request->id = i;
+            requests.push_back(std::move(request));
+        }
+    }
+    return requests;
+}
+
+std::string WriteResponses(const TransportDatabase& db, const std::vector<RequestHolder>& requests, size_t thread_count) {
+    std::ostringstream os;
+    {
+        Json::Writer writer(os);
+        ProcessRequests(db, requests, writer, thread_count);
+    }
+    return os.str();
+}
+
+void TestParallelRequests() {
+    const TransportDatabase db = MakeLargeTestDatabase(1000, 200);
+    const auto requests = MakeReadRequests(10000, 1000, 200);
+    const std::string expected = WriteResponses(db, requests, 1);
+    ASSERT_EQUAL(WriteResponses(db, requests, 3), expected);
+    ASSERT_EQUAL(WriteResponses(db, requests, 8), expected);
+    ASSERT_EQUAL(WriteResponses(db, {}, 4), "[]");
+}
+
+void BenchmarkParallelRequests() {
+    const TransportDatabase db = MakeLargeTestDatabase(20000, 5000);
+    const auto requests = MakeReadRequests(1000000, 20000, 5000);
+    const size_t max_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::cerr << "Hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+    std::string expected;
+    for (size_t thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+        std::string output;
+        {
+            LOG_DURATION("ProcessRequests, " + std::to_string(thread_count) + " threads");
+            output = WriteResponses(db, requests, thread_count);
+        }
+        if (thread_count == 1) {
+            expected = std::move(output);
+        } else {
+            ASSERT(output == expected);
+        }
+    }
+}
+
+void TestAllTransportDB() {
+    TestRunner tr;
+    RUN_TEST(tr, TestStopInfo);
+    RUN_TEST(tr, TestRoadDistances);
+    RUN_TEST(tr, TestBusInfo);
+    RUN_TEST(tr, TestBusStatsCache);
+    RUN_TEST(tr, TestParallelFinalize);
+    RUN_TEST(tr, TestRoute);
+    RUN_TEST(tr, TestRouteGraphIsLinear);
+    RUN_TEST(tr, TestRouteAStarAgreesWithAllPairs);
+    RUN_TEST(tr, TestParallelRequests);
+    RUN_TEST(tr, BenchmarkParallelRequests);
+}
@@ -1,23 +1,29 @@
 #pragma once
 
 #include <iostream>
-#include <iomanip>
 #include <string>
-#include <sstream>
 #include <unordered_map>
-#include <unordered_set>
 #include <cmath>
 #include <memory>
-#include <set>
 #include <map>
 #include <optional>
+#include <algorithm>
+#include <vector>
+#include <future>
+#include <thread>
+#include <stdexcept>
 
 #include "string_parses.h"
 #include "json.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include "interner.h"
+#include "transport_router.h"
 
 const double PI = 3.1415926535;
 const double EARTH_RADIUS = 6371000;
 
+// Stop as it comes in a base request. TransportDatabase keeps it as a StopRecord.
 class Stop {
 public:
 
@@ -26,9 +32,10 @@ public:
         stop_name = name;
     }
 
-    static Stop ParseFrom(const Json::Node& request_node) {
+    template <typename NodeType>
+    static Stop ParseFrom(const NodeType& request_node) {
         // input = "X: latitude, longitude, D1m to stop1, D2m to stop2, ..."
-        std::string name = request_node.AsMap().at("name").AsString();
+        std::string name(request_node.AsMap().at("name").AsString());
         const double latitude = request_node.AsMap().at("latitude").AsDouble();
         const double longitude = request_node.AsMap().at("longitude").AsDouble();
         if(request_node.AsMap().count("road_distances") == 0) {
@@ -36,12 +43,35 @@ public:
         } else {
             Stop stop(name, latitude, longitude);
             for (const auto& [stop_name, distance] : request_node.AsMap().at("road_distances").AsMap()) {
-                stop.AddDistance(stop_name, distance.AsInt());
+                stop.AddDistance(std::string(stop_name), distance.AsInt());
             }
             return stop;
         }
     }
 
+    static Stop ParseFrom(Json::Reader& reader) {
+        Stop stop;
+        reader.BeginObject();
+        for (std::string_view key; reader.NextKey(key); ) {
+            if (key == "name") {
+                stop.stop_name = reader.ReadString();
+            } else if (key == "latitude") {
+                stop.latitude = reader.ReadDouble();
+            } else if (key == "longitude") {
+                stop.longitude = reader.ReadDouble();
+            } else if (key == "road_distances") {
+                reader.BeginObject();
+                for (std::string_view stop_name; reader.NextKey(stop_name); ) {
+                    std::string name(stop_name);
+                    stop.AddDistance(name, reader.ReadInt());
+                }
+            } else {
+                reader.SkipValue();
+            }
+        }
+        return stop;
+    }
+
     void SetLatitude(double lat) {
         latitude = lat;
     }
@@ -50,7 +80,7 @@ public:
         longitude = lon;
     }
 
-    std::string GetName() const {
+    const std::string& GetName() const {
         return stop_name;
     }
 
@@ -62,14 +92,6 @@ public:
         return longitude;
     }
 
-    void AddBusToStop(const std::string& bus_number) {
-        buses_for_stop.insert(bus_number);
-    }
-
-    const std::set<std::string>& GetBuses() const {
-        return buses_for_stop;
-    }
-
     void AddDistance(const std::string& stop_name, int distance) {
         distances[stop_name] = distance;
     }
@@ -93,215 +115,340 @@ private:
     std::string stop_name;
     std::optional<double> latitude;
     std::optional<double> longitude;
-    std::set<std::string> buses_for_stop;
     std::unordered_map<std::string, int> distances;
 
     Stop(std::string name, double latitude, double longitude) 
         : stop_name(name), latitude(latitude), longitude(longitude) {}
 };
 
+using StopId = Interner::Id;
+using BusId = Interner::Id;
+
+// Stop inside TransportDatabase: everything refers to other stops and buses by id.
+struct StopRecord {
+    // Stops mentioned only in road_distances are interned too, but don't exist for queries.
+    bool is_added = false;
+    std::optional<double> latitude;
+    std::optional<double> longitude;
+    // Sorted by bus name, as the Stop response lists them.
+    std::vector<BusId> buses;
+    // Sorted by stop id.
+    std::vector<std::pair<StopId, int>> distances;
+
+    std::optional<int> GetDistance(StopId stop_id) const {
+        auto it = std::lower_bound(distances.begin(), distances.end(), std::pair{stop_id, 0},
+            [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+        if (it == distances.end() || it->first != stop_id) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    void AddDistance(StopId stop_id, int distance) {
+        auto it = std::lower_bound(distances.begin(), distances.end(), std::pair{stop_id, 0},
+            [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+        if (it == distances.end() || it->first != stop_id) {
+            distances.insert(it, {stop_id, distance});
+        }
+    }
+};
+
 class Bus {
 public:
     Bus() = default;
-    Bus(std::string number, std::vector<std::string> stops) 
-        : bus_number(number) {
-            for (auto& stop : stops)
-                route.push_back(std::move(stop));
-        }
+    Bus(std::vector<StopId> stops) 
+        : route(std::move(stops)) {}
 
-    std::vector<std::string> GetRoute() const {
+    const std::vector<StopId>& GetRoute() const {
         return route;
     }
 
 private:
-    std::string bus_number;
-    std::vector<std::string> route;
+    std::vector<StopId> route;
+};
+
+// Everything a Bus response needs, computed once per bus in TransportDatabase::Finalize.
+struct BusStats {
+    size_t stop_count = 0;
+    size_t unique_stop_count = 0;
+    int route_length = 0;
+    double curvature = 0.;
 };
 
 class TransportDatabase {
 public:
     TransportDatabase() = default;
 
-    void CheckAndSetStopCoordinates(const Stop& stop) {
-        auto it_stop = stops.find(stop.GetName());
-        bool has_coordinates = it_stop->second->GetLatitude().has_value() && it_stop->second->GetLongitude().has_value();
+    void CheckAndSetStopCoordinates(StopRecord& record, const Stop& stop) {
+        bool has_coordinates = record.latitude.has_value() && record.longitude.has_value();
         if (!has_coordinates) {
             if (stop.GetLatitude().has_value() && stop.GetLongitude().has_value()) {
-                it_stop->second->SetLatitude(stop.GetLatitude().value());
-                it_stop->second->SetLongitude(stop.GetLongitude().value());
+                record.latitude = stop.GetLatitude();
+                record.longitude = stop.GetLongitude();
             }
         }
     }
 
-    void AddReverseDistances(const Stop& stop) {
+    void AddStop(const Stop& stop) {
+        bus_stats.clear();
+        router.reset();
+        const StopId stop_id = InternStop(stop.GetName());
+        CheckAndSetStopCoordinates(stops[stop_id], stop);
+        stops[stop_id].is_added = true;
+
+        // Merge stop.GetDistances() without overwriting the known ones
         for (const auto& [stop_name, distance] : stop.GetDistances()) {
-            auto it = stops.find(stop_name);
-            if (it != stops.end()) {
-                it->second->AddDistance(stop.GetName(), distance);
-            } else {
-                stops[stop_name] = std::shared_ptr<Stop>(new Stop(stop_name));
-                stops[stop_name]->AddDistance(stop.GetName(), distance);
-            }
+            const StopId to_id = InternStop(stop_name);
+            stops[stop_id].AddDistance(to_id, distance);
         }
     }
 
-    void AddStop(const Stop& stop) {
-        auto current_stop_name = stop.GetName();
-        auto it_stop = stops.find(current_stop_name);
-        if (it_stop == stops.end()) {
-            stops[current_stop_name] = std::shared_ptr<Stop>(new Stop(stop));
-            //AddReverseDistances(stop);
+    void AddBus(const std::string& bus_number, const std::vector<std::string>& stops_on_route) {
+        bus_stats.clear();
+        router.reset();
+        const BusId bus_id = bus_names.Intern(bus_number);
+        if (bus_id == buses.size()) {
+            buses.emplace_back();
+        }
+
+        std::vector<StopId> route;
+        route.reserve(stops_on_route.size());
+        for (const auto& stop : stops_on_route) {
+            const StopId stop_id = InternStop(stop);
+            stops[stop_id].is_added = true;
+            AddBusToStop(stops[stop_id], bus_id);
+            route.push_back(stop_id);
+        }
+        buses[bus_id] = Bus(std::move(route));
+    }
 
+    void WriteStopInfo(std::string_view stop_name, int id, Json::Writer& writer) const {
+        writer.BeginObject();
+        if (const auto stop_id = FindStop(stop_name)) {
+            writer.Key("buses").BeginArray();
+            for (const BusId bus_id : stops[*stop_id].buses) {
+                writer.Value(bus_names.GetName(bus_id));
+            }
+            writer.EndArray();
         } else {
-            CheckAndSetStopCoordinates(stop);
+            writer.Key("error_message").Value("not found");
+        }
+        writer.Key("request_id").Value(id);
+        writer.EndObject();
+    }
 
-            //AddReverseDistances(stop);
+    void WriteBusInfo(std::string_view bus_number, int id, Json::Writer& writer) const {
+        writer.BeginObject();
+        if (const auto bus_id = bus_names.Find(bus_number)) {
+            const BusStats stats = GetBusStats(*bus_id);
+            writer.Key("route_length").Value(stats.route_length);
+            writer.Key("request_id").Value(id);
+            writer.Key("curvature").Value(stats.curvature);
+            writer.Key("stop_count").Value(stats.stop_count);
+            writer.Key("unique_stop_count").Value(stats.unique_stop_count);
+        } else {
+            writer.Key("error_message").Value("not found");
+            writer.Key("request_id").Value(id);
+        }
+        writer.EndObject();
+    }
 
-            // Merge stop.GetDistances() to stops[current_stop_name] without overwriting
-            for (const auto& [stop_name, distance] : stop.GetDistances()) {
-                if (it_stop->second->GetDistances().count(stop_name) == 0) {
-                    it_stop->second->AddDistance(stop_name, distance);
+    void WriteRouteInfo(std::string_view from, std::string_view to, int id, Json::Writer& writer) const {
+        if (!router) {
+            throw std::logic_error("Route requests need routing settings and Finalize");
+        }
+        writer.BeginObject();
+        writer.Key("request_id").Value(id);
+        const auto from_id = FindStop(from);
+        const auto to_id = FindStop(to);
+        const auto itinerary = from_id && to_id ? router->FindRoute(*from_id, *to_id) : std::nullopt;
+        if (itinerary) {
+            writer.Key("total_time").Value(itinerary->total_time);
+            writer.Key("items").BeginArray();
+            for (const auto& item : itinerary->items) {
+                writer.BeginObject();
+                if (item.type == TransportRouter::Itinerary::Item::Type::WAIT) {
+                    writer.Key("type").Value("Wait");
+                    writer.Key("stop_name").Value(stop_names.GetName(item.id));
+                } else {
+                    writer.Key("type").Value("Bus");
+                    writer.Key("bus").Value(bus_names.GetName(item.id));
+                    writer.Key("span_count").Value(item.span_count);
                 }
+                writer.Key("time").Value(item.time);
+                writer.EndObject();
             }
+            writer.EndArray();
+        } else {
+            writer.Key("error_message").Value("not found");
         }
+        writer.EndObject();
     }
 
-    void AddBus(const std::string& bus_number, const std::vector<std::string>& stops_on_route) {
-        for (const auto& stop : stops_on_route) {
-            AddStop(stop);
-            stops[stop]->AddBusToStop(bus_number);
+    // Route requests are answered only with these settings, by a router built in Finalize
+    void SetRoutingSettings(const RoutingSettings& settings) {
+        routing_settings = settings;
+        router.reset();
+    }
+
+    // Called once all base requests are in: precomputes the answers to Bus requests
+    // and builds the router, alongside each other.
+    // Any later AddStop/AddBus drops them: WriteBusInfo falls back to computing on the fly,
+    // Route requests need another Finalize.
+    void Finalize(size_t thread_count = std::thread::hardware_concurrency()) {
+        std::future<void> router_future;
+        if (routing_settings) {
+            router_future = std::async(std::launch::async, [this] { BuildRouter(); });
         }
-        buses[bus_number] = std::shared_ptr<Bus>(new Bus(move(bus_number), move(stops_on_route)));
-    }
-
-    std::string GetStopInfo(const std::string& stop_name, int id) const {
-        // Example: 
-        /*      
-            "buses": [
-              "256",
-              "828"
-            ],
-            "request_id": 1042838872
-        */
-        std::vector<std::string> buses;
-        std::ostringstream os;
-        auto it = stops.find(stop_name);
-        if (it != stops.end()) {
-            for (const auto& bus : it->second->GetBuses()) {
-                buses.push_back(std::string(bus));
-            }
-            if (!buses.empty()) {
-                os << "{\n";
-                os << "  \"buses\": [\n";
-                for (size_t i = 0; i < buses.size(); ++i) {
-                    os << "    \"" << buses[i] << "\"";
-                    if (i != buses.size() - 1) {
-                        os << ",\n";
-                    } else {
-                        os << "\n";
-                    }
+        bus_stats.resize(buses.size());
+        const size_t chunk_size = std::max<size_t>(MIN_BUSES_PER_THREAD,
+                                                   (buses.size() + thread_count - 1) / std::max<size_t>(thread_count, 1));
+        std::vector<std::future<void>> futures;
+        for (size_t begin = 0; begin < buses.size(); begin += chunk_size) {
+            const size_t end = std::min(begin + chunk_size, buses.size());
+            futures.push_back(std::async(std::launch::async, [this, begin, end] {
+                for (BusId bus_id = begin; bus_id < end; ++bus_id) {
+                    bus_stats[bus_id] = ComputeBusStats(bus_id);
                 }
-                os << "  ],\n";
-                os << "  \"request_id\": " << id << "\n";
-                os << "}";
-            } else {
-                os << "{\n";
-                os << "  \"buses\": [],\n";
-                os << "  \"request_id\": " << id << "\n";
-                os << "}";
-            }
-        } else {
-            os << "{\n";
-            os << "  \"error_message\": \"not found\",\n";
-            os << "  \"request_id\": " << id << "\n";
-            os << "}";
+            }));
         }
-        return os.str();
-    }
-
-    std::string GetBusInfo(const std::string& bus_number, int id) const {
-        // Rebuild as JSON
-        // Example:
-        /* 
-            "route_length": 27600,
-            "request_id": 519139350,
-            "curvature": 1.31808,
-            "stop_count": 5,
-            "unique_stop_count": 3
-        */
-        
-        std::ostringstream os;
-        if (buses.count(bus_number) == 0) {
-            os << "{\n";
-            os << "  \"error_message\": \"not found\",\n";
-            os << "  \"request_id\": " << id << "\n";
-            os << "}";
-            return os.str();
-        } else {
-            auto route = buses.at(bus_number)->GetRoute();
-            std::unordered_set<std::string> unique_stops(route.begin(), route.end());
-            auto [route_length, fact_route_length] = ComputeRouteAndFactRouteLength(bus_number);
-            double c = fact_route_length / route_length;
-            os << "{\n";
-            os << "  \"route_length\": " << fact_route_length << ",\n";
-            os << "  \"request_id\": " << id << ",\n";
-            os << "  \"curvature\": " << std::fixed << std::setprecision(6) << c << ",\n";
-            os << "  \"stop_count\": " << route.size() << ",\n";
-            os << "  \"unique_stop_count\": " << unique_stops.size() << "\n";
-            os << "}";
-            return os.str();
+        for (auto& f : futures) {
+            f.get();
         }
+        if (router_future.valid()) {
+            router_future.get();
+        }
+    }
+
+    BusStats GetBusStats(BusId bus_id) const {
+        return bus_id < bus_stats.size() ? bus_stats[bus_id] : ComputeBusStats(bus_id);
+    }
+
+    BusStats ComputeBusStats(BusId bus_id) const {
+        const auto& route = buses[bus_id].GetRoute();
+        std::vector<StopId> unique_stops = route;
+        std::sort(unique_stops.begin(), unique_stops.end());
+        unique_stops.erase(std::unique(unique_stops.begin(), unique_stops.end()), unique_stops.end());
+        auto [route_length, fact_route_length] = ComputeRouteAndFactRouteLength(bus_id);
+
+        BusStats stats;
+        stats.stop_count = route.size();
+        stats.unique_stop_count = unique_stops.size();
+        stats.route_length = fact_route_length;
+        stats.curvature = fact_route_length / route_length;
+        return stats;
     }
 
-    const auto& GetBus(const std::string& bus_number) const {
-        return buses.at(bus_number);
+    const Bus& GetBus(const std::string& bus_number) const {
+        return buses.at(bus_names.Find(bus_number).value());
     }
 
-    const auto& GetStop(const std::string& stop_name) const {
-        return stops.at(stop_name);
+    const StopRecord& GetStop(const std::string& stop_name) const {
+        return stops.at(FindStop(stop_name).value());
     }
 
-    static double ComputeDistance(const Stop& lhs, const Stop& rhs) {
-        if (!lhs.GetLatitude() || !lhs.GetLongitude() || !rhs.GetLatitude() || !rhs.GetLongitude()) {
+    std::optional<StopId> FindStop(std::string_view stop_name) const {
+        const auto stop_id = stop_names.Find(stop_name);
+        if (!stop_id || !stops[*stop_id].is_added) {
+            return std::nullopt;
+        }
+        return stop_id;
+    }
+
+    const std::string& GetStopName(StopId stop_id) const {
+        return stop_names.GetName(stop_id);
+    }
+
+    const std::string& GetBusName(BusId bus_id) const {
+        return bus_names.GetName(bus_id);
+    }
+
+    static double ComputeDistance(const StopRecord& lhs, const StopRecord& rhs) {
+        if (!lhs.latitude || !lhs.longitude || !rhs.latitude || !rhs.longitude) {
             std::cerr << "NO coordinates" << std::endl;
         }
 
-        double lhs_lat = toRadians(*lhs.GetLatitude());
-        double rhs_lat = toRadians(*rhs.GetLatitude());
-        double lhs_lon = toRadians(*lhs.GetLongitude());
-        double rhs_lon = toRadians(*rhs.GetLongitude());
+        double lhs_lat = toRadians(*lhs.latitude);
+        double rhs_lat = toRadians(*rhs.latitude);
+        double lhs_lon = toRadians(*lhs.longitude);
+        double rhs_lon = toRadians(*rhs.longitude);
 
         return acos(sin(lhs_lat) * sin(rhs_lat) + 
                     cos(lhs_lat) * cos(rhs_lat) *
                     cos(fabs(lhs_lon - rhs_lon))) * EARTH_RADIUS;
     }
 
-    std::pair<double, int> ComputeRouteAndFactRouteLength(const std::string& bus_number) const {
+    std::pair<double, int> ComputeRouteAndFactRouteLength(BusId bus_id) const {
         double route_length = 0.;
         int fact_route_length = 0.;
-        const auto& route = buses.at(bus_number)->GetRoute();
+        const auto& route = buses[bus_id].GetRoute();
         for (size_t i = 1; i < route.size(); ++i) {
-            route_length += ComputeDistance(*stops.at(route[i - 1]), *stops.at(route[i]));
+            route_length += ComputeDistance(stops[route[i - 1]], stops[route[i]]);
             fact_route_length += FindDistance(route[i - 1], route[i]);
         }
         return {route_length, fact_route_length};
     }
 
-    int FindDistance(const std::string& stop1, const std::string& stop2) const {
+    int FindDistance(StopId stop1, StopId stop2) const {
         // если для stop1 нет расстояния до stop2, то вернуть расстояние от stop2 до stop1
-        auto it = stops.find(stop1);
-        if (it != stops.end()) {
-            auto distance = it->second->GetDistance(stop2);
-            if (distance.has_value()) {
-                return distance.value();
-            }
+        auto distance = stops[stop1].GetDistance(stop2);
+        if (distance.has_value()) {
+            return distance.value();
         }
-        return stops.at(stop2)->GetDistance(stop1).value();
+        return stops[stop2].GetDistance(stop1).value();
     }
 
 private:
-    std::unordered_map<std::string, std::shared_ptr<Bus>> buses;
-    std::unordered_map<std::string, std::shared_ptr<Stop>> stops;
+    // Names are resolved to ids once at ingest, the rest of the database is indexed by id.
+    Interner stop_names;
+    Interner bus_names;
+    std::vector<Bus> buses;
+    std::vector<StopRecord> stops;
+    std::vector<BusStats> bus_stats;
+    std::optional<RoutingSettings> routing_settings;
+    std::unique_ptr<TransportRouter> router;
+
+    // Below this many buses per thread Finalize is not worth spawning threads for.
+    static const size_t MIN_BUSES_PER_THREAD = 256;
+
+    void BuildRouter() {
+        size_t position_count = 0;
+        for (const Bus& bus : buses) {
+            position_count += bus.GetRoute().size();
+        }
+        router = std::make_unique<TransportRouter>(stops.size(), position_count, *routing_settings);
+        for (StopId stop_id = 0; stop_id < stops.size(); ++stop_id) {
+            if (stops[stop_id].latitude && stops[stop_id].longitude) {
+                router->SetStopCoordinates(stop_id, *stops[stop_id].latitude, *stops[stop_id].longitude);
+            }
+        }
+        std::vector<int> distances;
+        for (BusId bus_id = 0; bus_id < buses.size(); ++bus_id) {
+            const auto& route = buses[bus_id].GetRoute();
+            distances.clear();
+            for (size_t i = 1; i < route.size(); ++i) {
+                distances.push_back(FindDistance(route[i - 1], route[i]));
+            }
+            router->AddBus(bus_id, route, distances);
+        }
+        router->Build();
+    }
+
+    StopId InternStop(std::string_view stop_name) {
+        const StopId stop_id = stop_names.Intern(stop_name);
+        if (stop_id == stops.size()) {
+            stops.emplace_back();
+        }
+        return stop_id;
+    }
+
+    void AddBusToStop(StopRecord& record, BusId bus_id) {
+        auto it = std::lower_bound(record.buses.begin(), record.buses.end(), bus_id,
+            [this](BusId lhs, BusId rhs) { return bus_names.GetName(lhs) < bus_names.GetName(rhs); });
+        if (it == record.buses.end() || *it != bus_id) {
+            record.buses.insert(it, bus_id);
+        }
+    }
 
     static double toRadians(double degree) {
         return degree * PI / 180.0;
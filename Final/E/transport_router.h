@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "graph.h"
+#include "router.h"
+#include "interner.h"
+#include "json_reader.h"
+
+struct RoutingSettings {
+    using Strategy = Graph::Router<double>::Strategy;
+
+    int bus_wait_time = 0;    // minutes
+    double bus_velocity = 0;  // km/h
+    // "router_strategy": "dijkstra", "a_star", "all_pairs" or "contraction_hierarchy"
+    Strategy strategy = Strategy::DIJKSTRA;
+
+    static RoutingSettings ParseFrom(Json::Reader& reader) {
+        RoutingSettings settings;
+        reader.BeginObject();
+        for (std::string_view key; reader.NextKey(key); ) {
+            if (key == "bus_wait_time") {
+                settings.bus_wait_time = reader.ReadInt();
+            } else if (key == "bus_velocity") {
+                settings.bus_velocity = reader.ReadDouble();
+            } else if (key == "router_strategy") {
+                settings.strategy = ParseStrategy(reader.ReadString());
+            } else {
+                reader.SkipValue();
+            }
+        }
+        return settings;
+    }
+
+    static Strategy ParseStrategy(std::string_view name) {
+        if (name == "dijkstra") {
+            return Strategy::DIJKSTRA;
+        } else if (name == "a_star") {
+            return Strategy::A_STAR;
+        } else if (name == "all_pairs") {
+            return Strategy::ALL_PAIRS;
+        } else if (name == "contraction_hierarchy") {
+            return Strategy::CONTRACTION_HIERARCHY;
+        }
+        throw std::invalid_argument("Unknown router strategy " + std::string(name));
+    }
+};
+
+// Fastest itineraries between stops, in minutes.
+// The graph has a vertex per stop, where a passenger waits, and a vertex per position
+// on every bus route, where they ride. Edges are
+//   stop -> ride vertex at that stop: boarding, bus_wait_time;
+//   ride vertex -> next ride vertex of the same bus: one span, distance / velocity;
+//   ride vertex -> its stop: getting off, 0;
+// so a route of N stops adds 3N - 1 edges rather than one edge per pair of its stops.
+// A_STAR estimates the time left as the straight-line distance to the target stop
+// over the fastest straight-line speed of any span. Boarding and getting off do not
+// move the passenger and every span is at most that fast, so the estimate never
+// exceeds the real time, whatever the road distances are.
+class TransportRouter {
+public:
+    using StopId = Interner::Id;
+    using BusId = Interner::Id;
+    using Strategy = RoutingSettings::Strategy;
+
+    struct Itinerary {
+        struct Item {
+            enum class Type {
+                WAIT,
+                BUS
+            };
+
+            Type type;
+            // Stop for WAIT, bus for BUS
+            Interner::Id id;
+            size_t span_count;
+            double time;
+        };
+
+        double total_time;
+        std::vector<Item> items;
+    };
+
+    // position_count is the total length of the routes to be added
+    TransportRouter(size_t stop_count, size_t position_count, const RoutingSettings& settings)
+        : settings(settings), graph(stop_count + position_count), next_vertex(stop_count),
+          vertex_stops(stop_count), stop_points(stop_count) {
+        edges.reserve(3 * position_count);
+        vertex_stops.reserve(stop_count + position_count);
+        for (StopId stop_id = 0; stop_id < stop_count; ++stop_id) {
+            vertex_stops[stop_id] = stop_id;
+        }
+    }
+
+    TransportRouter(const TransportRouter&) = delete;
+    TransportRouter& operator=(const TransportRouter&) = delete;
+
+    // Stops without coordinates leave A_STAR without an estimate, then it works as DIJKSTRA
+    void SetStopCoordinates(StopId stop_id, double latitude, double longitude) {
+        const double lat = latitude * RADIANS_PER_DEGREE;
+        const double lon = longitude * RADIANS_PER_DEGREE;
+        stop_points[stop_id] = Point{std::cos(lat) * std::cos(lon), std::cos(lat) * std::sin(lon), std::sin(lat)};
+    }
+
+    // distances[i] is the road distance in meters from route[i] to route[i + 1]
+    void AddBus(BusId bus_id, const std::vector<StopId>& route, const std::vector<int>& distances) {
+        const double meters_per_minute = settings.bus_velocity * 1000. / 60.;
+        for (size_t i = 0; i < route.size(); ++i) {
+            const Graph::VertexId ride_vertex = next_vertex++;
+            vertex_stops.push_back(route[i]);
+            AddEdge({route[i], ride_vertex, static_cast<double>(settings.bus_wait_time)}, {EdgeType::BOARD, route[i]});
+            AddEdge({ride_vertex, route[i], 0.}, {EdgeType::ALIGHT, route[i]});
+            if (i + 1 < route.size()) {
+                AddEdge({ride_vertex, ride_vertex + 1, distances[i] / meters_per_minute}, {EdgeType::RIDE, bus_id});
+            }
+        }
+    }
+
+    // Called once all buses and coordinates are added
+    void Build() {
+        Build(settings.strategy);
+    }
+
+    void Build(Strategy strategy) {
+        const std::vector<Graph::EdgeId> new_ids = graph.Freeze();
+        std::vector<EdgeInfo> frozen_edges(edges.size());
+        for (Graph::EdgeId edge_id = 0; edge_id < edges.size(); ++edge_id) {
+            frozen_edges[new_ids[edge_id]] = edges[edge_id];
+        }
+        edges = std::move(frozen_edges);
+        if (strategy == Strategy::A_STAR) {
+            max_point_speed = ComputeMaxPointSpeed();
+            router = std::make_unique<Graph::Router<double>>(graph, strategy,
+                [this](Graph::VertexId from, Graph::VertexId to) { return EstimateTime(from, to); });
+        } else {
+            router = std::make_unique<Graph::Router<double>>(graph, strategy);
+        }
+    }
+
+    std::optional<Itinerary> FindRoute(StopId from, StopId to) const {
+        const auto route = router->BuildRoute(from, to);
+        if (!route) {
+            return std::nullopt;
+        }
+        Itinerary itinerary{route->weight, {}};
+        for (size_t i = 0; i < route->edge_count; ++i) {
+            const Graph::EdgeId edge_id = router->GetRouteEdge(route->id, i);
+            const EdgeInfo& info = edges[edge_id];
+            const double time = graph.GetEdge(edge_id).weight;
+            if (info.type == EdgeType::BOARD) {
+                itinerary.items.push_back({Itinerary::Item::Type::WAIT, info.id, 0, time});
+            } else if (info.type == EdgeType::RIDE) {
+                // Consecutive spans of one ride make one item
+                auto& items = itinerary.items;
+                if (items.empty() || items.back().type != Itinerary::Item::Type::BUS) {
+                    items.push_back({Itinerary::Item::Type::BUS, info.id, 0, 0.});
+                }
+                ++items.back().span_count;
+                items.back().time += time;
+            }
+        }
+        router->ReleaseRoute(route->id);
+        return itinerary;
+    }
+
+    size_t GetEdgeCount() const {
+        return graph.GetEdgeCount();
+    }
+
+private:
+    enum class EdgeType {
+        BOARD,
+        RIDE,
+        ALIGHT
+    };
+
+    struct EdgeInfo {
+        EdgeType type;
+        // Stop for BOARD and ALIGHT, bus for RIDE
+        Interner::Id id;
+    };
+
+    // A stop on the unit sphere, straight-line distances are chords
+    struct Point {
+        double x;
+        double y;
+        double z;
+
+        double DistanceTo(const Point& other) const {
+            return std::hypot(x - other.x, y - other.y, z - other.z);
+        }
+    };
+
+    static constexpr double RADIANS_PER_DEGREE = 3.14159265358979323846 / 180.;
+    static constexpr double INFINITE_SPEED = std::numeric_limits<double>::infinity();
+
+    const RoutingSettings settings;
+    Graph::DirectedWeightedGraph<double> graph;
+    // Indexed by EdgeId
+    std::vector<EdgeInfo> edges;
+    Graph::VertexId next_vertex;
+    // Indexed by VertexId
+    std::vector<StopId> vertex_stops;
+    // Indexed by StopId
+    std::vector<std::optional<Point>> stop_points;
+    // Chord length per minute, infinite when some span cannot be bounded
+    double max_point_speed = INFINITE_SPEED;
+    std::unique_ptr<Graph::Router<double>> router;
+
+    void AddEdge(const Graph::Edge<double>& edge, EdgeInfo info) {
+        graph.AddEdge(edge);
+        edges.push_back(info);
+    }
+
+    double ComputeMaxPointSpeed() const {
+        double max_speed = 0.;
+        for (Graph::EdgeId edge_id = 0; edge_id < edges.size(); ++edge_id) {
+            if (edges[edge_id].type != EdgeType::RIDE) {
+                continue;
+            }
+            const auto& edge = graph.GetEdge(edge_id);
+            const auto& from_point = stop_points[vertex_stops[edge.from]];
+            const auto& to_point = stop_points[vertex_stops[edge.to]];
+            if (!from_point || !to_point) {
+                return INFINITE_SPEED;
+            }
+            const double distance = from_point->DistanceTo(*to_point);
+            if (distance > 0) {
+                max_speed = std::max(max_speed, edge.weight > 0 ? distance / edge.weight : INFINITE_SPEED);
+            }
+        }
+        return max_speed;
+    }
+
+    double EstimateTime(Graph::VertexId from, Graph::VertexId to) const {
+        const auto& from_point = stop_points[vertex_stops[from]];
+        const auto& to_point = stop_points[vertex_stops[to]];
+        if (!from_point || !to_point || max_point_speed == INFINITE_SPEED || max_point_speed == 0.) {
+            return 0.;
+        }
+        return from_point->DistanceTo(*to_point) / max_point_speed;
+    }
+};